@@ -0,0 +1,173 @@
+// Load generator for the telemetry server's latency counters.
+//
+//   latency_bench [-h host] [-p port] [-n sources] [-i interval_ms] [-d seconds]
+//
+// Adds n fast temperature sources to a running server, lets them run for
+// the given time and prints the generator wakeup and tick lateness
+// percentiles reported by LATENCY. Run it against a server started with
+// and without -I/-G to compare thread placements.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BASE_ID 900000
+#define BENCH_BUFFER_SIZE 65536
+
+static unsigned char buffer[BENCH_BUFFER_SIZE];
+static size_t buffered = 0;
+
+static int send_line(int fd, const char *line) {
+    size_t len = strlen(line);
+    while (len > 0) {
+        ssize_t n = send(fd, line, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("send");
+            return -1;
+        }
+        line += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static size_t value_size(uint8_t type) {
+    switch (type) {
+        case 0: case 1: case 2: return 4;
+        case 3: return 16;
+        case 4: return 20;
+        default: return 0;
+    }
+}
+
+// Consumes complete records from the buffer and prints 'R' replies that
+// start with `prefix`. Returns how many were printed.
+static int drain_records(const char *prefix) {
+    size_t pos = 0;
+    int printed = 0;
+
+    while (pos < buffered) {
+        size_t left = buffered - pos;
+        unsigned char tag = buffer[pos];
+        size_t need;
+
+        if (tag == 'T') {
+            if (left < 14) break;
+            need = 14 + value_size(buffer[pos + 5]);
+        } else if (tag == 'R') {
+            if (left < 3) break;
+            uint16_t len;
+            memcpy(&len, buffer + pos + 1, sizeof(len));
+            need = 3 + ntohs(len);
+        } else if (tag == 'Z') {
+            if (left < 9) break;
+            uint32_t len;
+            memcpy(&len, buffer + pos + 5, sizeof(len));
+            need = 9 + ntohl(len);
+        } else {
+            fprintf(stderr, "Unknown record tag 0x%02x\n", tag);
+            exit(EXIT_FAILURE);
+        }
+        if (left < need) break;
+
+        if (tag == 'R' && prefix != NULL && strncmp((char *)buffer + pos + 3, prefix, strlen(prefix)) == 0) {
+            printf("%.*s\n", (int)(need - 3), (char *)buffer + pos + 3);
+            printed++;
+        }
+        pos += need;
+    }
+
+    memmove(buffer, buffer + pos, buffered - pos);
+    buffered -= pos;
+    return printed;
+}
+
+static int read_for(int fd, int ms, const char *prefix, int want) {
+    struct timespec start, now;
+    int printed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= ms || (want > 0 && printed >= want)) {
+            return printed;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, (int)(ms - elapsed)) <= 0) {
+            continue;
+        }
+        ssize_t n = recv(fd, buffer + buffered, sizeof(buffer) - buffered, 0);
+        if (n <= 0) {
+            fprintf(stderr, "Server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+        buffered += (size_t)n;
+        printed += drain_records(prefix);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    int port = 8080, sources = 200, interval_ms = 10, seconds = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:i:d:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': sources = atoi(optarg); break;
+            case 'i': interval_ms = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-h host] [-p port] [-n sources] [-i interval_ms] [-d seconds]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    char line[128];
+    for (int i = 0; i < sources; ++i) {
+        snprintf(line, sizeof(line), "ADD temperature %d %d\n", BENCH_BASE_ID + i, interval_ms);
+        if (send_line(fd, line) < 0) return EXIT_FAILURE;
+        if (i % 32 == 31) read_for(fd, 1, NULL, 0);
+    }
+    read_for(fd, 1000, NULL, 0);
+
+    send_line(fd, "LATENCY RESET\n");
+    printf("%d sources every %d ms for %d s\n", sources, interval_ms, seconds);
+    read_for(fd, seconds * 1000, NULL, 0);
+
+    send_line(fd, "LATENCY\n");
+    read_for(fd, 5000, "generator_wakeup", 1);
+    send_line(fd, "LATENCY\n");
+    read_for(fd, 5000, "tick", 1);
+
+    for (int i = 0; i < sources; ++i) {
+        snprintf(line, sizeof(line), "REMOVE %d\n", BENCH_BASE_ID + i);
+        if (send_line(fd, line) < 0) break;
+        if (i % 32 == 31) read_for(fd, 1, NULL, 0);
+    }
+    read_for(fd, 200, NULL, 0);
+    close(fd);
+    return EXIT_SUCCESS;
+}
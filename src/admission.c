@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "server_utils.h"
+#include "snapshot.h"
+
+static size_t max_clients = 0; // 0 - no limit besides memory
+static admission_stats stats;
+static latency_hist accept_latency; // poll wakeup to the peer being served, us
+static long long backoff_until_ms = 0;
+
+void admission_set_limit(size_t limit) {
+    max_clients = limit;
+}
+
+size_t admission_limit(void) {
+    return max_clients;
+}
+
+static void refuse(int fd, unsigned long long *counter) {
+    close(fd);
+    (*counter)++;
+}
+
+// Registers an accepted peer; returns false when it was refused.
+static bool admit(int connect_fd, struct pollfd **fds, client_conn ***conns,
+                  nfds_t *nfds, size_t *fds_capacity) {
+    if (max_clients > 0 && *nfds - POLL_RESERVED_FDS >= max_clients) {
+        refuse(connect_fd, &stats.refused_limit);
+        return false;
+    }
+    if (*nfds >= *fds_capacity && fds_realloc(fds, conns, fds_capacity) < 0) {
+        fprintf(stderr, "Ошибка realloc fds, не можем добавить клиента fd=%d\n", connect_fd);
+        refuse(connect_fd, &stats.refused_memory);
+        return false;
+    }
+
+    client_conn *conn = client_conn_create(connect_fd);
+    if (conn == NULL) {
+        refuse(connect_fd, &stats.refused_memory);
+        return false;
+    }
+
+    // Current state right away: the shared snapshot by reference, one
+    // write, no serialization per joining client. Without chunk memory the
+    // client waits for the tick instead.
+    if (snapshot_send(conn) < 0) {
+        fprintf(stderr, "No memory to queue the snapshot for fd=%d\n", connect_fd);
+    }
+    if (client_flush(conn) < 0) {
+        client_conn_destroy(conn);
+        close(connect_fd);
+        return false;
+    }
+
+    (*conns)[*nfds] = conn;
+    (*fds)[*nfds].fd = connect_fd;
+    (*fds)[*nfds].events = POLLIN;
+    (*fds)[*nfds].revents = 0;
+    (*nfds)++;
+    stats.accepted++;
+    return true;
+}
+
+void admission_accept(int listen_fd, struct pollfd **fds, client_conn ***conns,
+                      nfds_t *nfds, size_t *fds_capacity, long long woke_us) {
+    size_t batch = 0, admitted = 0;
+    stats.wakeups++;
+
+    while (batch < ACCEPT_BATCH_MAX) {
+        int connect_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connect_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4");
+                stats.accept_errors++;
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    backoff_until_ms = monotonic_ms() + ACCEPT_BACKOFF_MS;
+                }
+            }
+            break;
+        }
+        batch++;
+
+        if (admit(connect_fd, fds, conns, nfds, fds_capacity)) {
+            latency_record(&accept_latency, monotonic_us() - woke_us);
+            admitted++;
+        }
+    }
+
+    if (batch > stats.largest_batch) {
+        stats.largest_batch = batch;
+    }
+    if (batch > 0) {
+        printf("Клиентов добавлено: %zu из %zu. Всего дескрипторов: %lu\n", admitted, batch, *nfds);
+    }
+}
+
+bool admission_backoff(long long now_ms) {
+    return now_ms < backoff_until_ms;
+}
+
+// When the current backoff ends, 0 - not backing off.
+long long admission_resume_ms(void) {
+    return backoff_until_ms > monotonic_ms() ? backoff_until_ms : 0;
+}
+
+void admission_get_stats(admission_stats *out) {
+    *out = stats;
+}
+
+void admission_latency(latency_summary *summary) {
+    latency_add(summary, &accept_latency);
+}
+
+void admission_reset_latency(void) {
+    latency_reset(&accept_latency);
+}
@@ -0,0 +1,40 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "client.h"
+#include "latency.h"
+
+// Accept path of the listener. Each wakeup drains the kernel queue with
+// accept4 up to ACCEPT_BATCH_MAX peers. Peers over the connection limit or
+// the memory budget are accepted and closed at once, so they get a prompt
+// refusal instead of sitting in the backlog.
+
+#define ACCEPT_BATCH_MAX 1024
+#define ACCEPT_BACKOFF_MS 100 // out of descriptors: stop polling the listener
+
+typedef struct admission_stats {
+    unsigned long long accepted;
+    unsigned long long refused_limit;  // over the connection limit
+    unsigned long long refused_memory; // memory budget spent
+    unsigned long long accept_errors;
+    unsigned long long wakeups;
+    size_t largest_batch;
+} admission_stats;
+
+void admission_set_limit(size_t max_clients);
+size_t admission_limit(void);
+
+void admission_accept(int listen_fd, struct pollfd **fds, client_conn ***conns,
+                      nfds_t *nfds, size_t *fds_capacity, long long woke_us);
+bool admission_backoff(long long now_ms);
+long long admission_resume_ms(void);
+
+void admission_get_stats(admission_stats *out);
+void admission_latency(latency_summary *summary);
+void admission_reset_latency(void);
+
+#endif // ADMISSION_H
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "affinity.h"
+
+#define SYSFS_NODE_DIR "/sys/devices/system/node"
+#define CPULIST_LINE_SIZE 4096
+
+static int cpu_node[AFFINITY_MAX_CPUS];
+static cpu_list node_cpus[AFFINITY_MAX_NODES];
+static int node_ids[AFFINITY_MAX_NODES];
+static int node_count = 0;
+
+int affinity_parse_cpulist(const char *str, cpu_list *out) {
+    const char *p = str;
+    out->count = 0;
+
+    while (*p != '\0' && *p != '\n') {
+        char *end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= AFFINITY_MAX_CPUS) {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= AFFINITY_MAX_CPUS) {
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && out->count < AFFINITY_MAX_CPUS; ++cpu) {
+            out->cpus[out->count++] = (int)cpu;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && !isspace((unsigned char)*p)) {
+            return -1;
+        }
+    }
+    return out->count > 0 ? 0 : -1;
+}
+
+static int read_cpulist_file(const char *path, cpu_list *out) {
+    char line[CPULIST_LINE_SIZE];
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char *ok = fgets(line, sizeof(line), file);
+    fclose(file);
+    if (ok == NULL) {
+        return -1;
+    }
+    return affinity_parse_cpulist(line, out);
+}
+
+// Without sysfs (containers, non-NUMA kernels) everything is node 0.
+int affinity_init(void) {
+    cpu_list online;
+    memset(cpu_node, 0, sizeof(cpu_node));
+    node_count = 0;
+
+    if (read_cpulist_file(SYSFS_NODE_DIR "/online", &online) == 0) {
+        for (int i = 0; i < online.count && node_count < AFFINITY_MAX_NODES; ++i) {
+            char path[128];
+            snprintf(path, sizeof(path), SYSFS_NODE_DIR "/node%d/cpulist", online.cpus[i]);
+            cpu_list *cpus = &node_cpus[node_count];
+            if (read_cpulist_file(path, cpus) < 0) {
+                cpus->count = 0; // memory-only node
+            }
+            for (int c = 0; c < cpus->count; ++c) {
+                cpu_node[cpus->cpus[c]] = online.cpus[i];
+            }
+            node_ids[node_count++] = online.cpus[i];
+        }
+    }
+
+    if (node_count == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        node_cpus[0].count = 0;
+        for (long c = 0; c < ncpu && c < AFFINITY_MAX_CPUS; ++c) {
+            node_cpus[0].cpus[node_cpus[0].count++] = (int)c;
+        }
+        node_ids[0] = 0;
+        node_count = 1;
+    }
+    return 0;
+}
+
+int affinity_node_count(void) {
+    return node_count;
+}
+
+int affinity_node_of_cpu(int cpu) {
+    if (cpu < 0 || cpu >= AFFINITY_MAX_CPUS) {
+        return -1;
+    }
+    return cpu_node[cpu];
+}
+
+static const cpu_list *cpus_of_node(int node) {
+    for (int i = 0; i < node_count; ++i) {
+        if (node_ids[i] == node) {
+            return &node_cpus[i];
+        }
+    }
+    return NULL;
+}
+
+static void fill_cpu_set(const cpu_list *cpus, cpu_set_t *set) {
+    CPU_ZERO(set);
+    for (int i = 0; i < cpus->count; ++i) {
+        CPU_SET(cpus->cpus[i], set);
+    }
+}
+
+int affinity_pin_self(const cpu_list *cpus) {
+    cpu_set_t set;
+    fill_cpu_set(cpus, &set);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+int affinity_pin_self_to_cpu(int cpu) {
+    cpu_list one = {.count = 1, .cpus = {cpu}};
+    return affinity_pin_self(&one);
+}
+
+static void print_cpu_list(const char *label, const cpu_list *cpus) {
+    printf("  %s:", label);
+    if (cpus == NULL || cpus->count == 0) {
+        printf(" unpinned\n");
+        return;
+    }
+    for (int i = 0; i < cpus->count; ++i) {
+        printf(" %d(n%d)", cpus->cpus[i], affinity_node_of_cpu(cpus->cpus[i]));
+    }
+    printf("\n");
+}
+
+void affinity_report(const cpu_list *io_cpus, const cpu_list *generator_cpus) {
+    printf("Topology: %ld online cpus, %d NUMA node(s)\n", sysconf(_SC_NPROCESSORS_ONLN), node_count);
+    for (int i = 0; i < node_count; ++i) {
+        printf("  node%d: %d cpus\n", node_ids[i], node_cpus[i].count);
+    }
+    print_cpu_list("io thread", io_cpus);
+    print_cpu_list("generators", generator_cpus);
+}
+
+// Fresh anonymous pages, faulted in while running on `node`. A negative
+// node or a single-node host skips the migration.
+void *node_alloc(size_t size, int node) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap node memory");
+        return NULL;
+    }
+
+    const cpu_list *cpus = node >= 0 && node_count > 1 ? cpus_of_node(node) : NULL;
+    if (cpus == NULL || cpus->count == 0) {
+        memset(ptr, 0, size);
+        return ptr;
+    }
+
+    cpu_set_t saved, target;
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+    fill_cpu_set(cpus, &target);
+    pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+    memset(ptr, 0, size);
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    return ptr;
+}
+
+void node_free(void *ptr, size_t size) {
+    if (ptr != NULL) {
+        munmap(ptr, size);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+
+// CPU sets are kept as plain lists so that callers do not need
+// _GNU_SOURCE for cpu_set_t. Node-local memory relies on the kernel's
+// first-touch policy: pages are faulted in by a thread running on the
+// target node.
+
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_MAX_NODES 64
+#define CACHE_LINE_SIZE 64
+
+typedef struct cpu_list {
+    int count;
+    int cpus[AFFINITY_MAX_CPUS];
+} cpu_list;
+
+int affinity_init(void);
+int affinity_parse_cpulist(const char *str, cpu_list *out);
+int affinity_pin_self(const cpu_list *cpus);
+int affinity_pin_self_to_cpu(int cpu);
+int affinity_node_of_cpu(int cpu);
+int affinity_node_count(void);
+void affinity_report(const cpu_list *io_cpus, const cpu_list *generator_cpus);
+
+void *node_alloc(size_t size, int node);
+void node_free(void *ptr, size_t size);
+
+#endif // AFFINITY_H
@@ -0,0 +1,322 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alarm.h"
+#include "conf.h"
+#include "endian_utils.h"
+
+#define EARTH_RADIUS_M 6371000.0
+#define DEG_TO_RAD (3.14159265358979323846 / 180.0)
+
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alarm_event ring[ALARM_RING_SIZE];
+static size_t ring_head = 0; // next to read
+static size_t ring_count = 0;
+static unsigned long long ring_dropped = 0;
+static int wake_pipe[2] = {-1, -1};
+
+int alarm_init(void) {
+    if (pipe(wake_pipe) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        int flags = fcntl(wake_pipe[i], F_GETFL, 0);
+        fcntl(wake_pipe[i], F_SETFL, flags | O_NONBLOCK);
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    return wake_pipe[0];
+}
+
+void alarm_shutdown(void) {
+    for (int i = 0; i < 2; ++i) {
+        if (wake_pipe[i] >= 0) {
+            close(wake_pipe[i]);
+            wake_pipe[i] = -1;
+        }
+    }
+}
+
+static int parse_key_double(char *token, const char *key, double *out) {
+    size_t key_len = strlen(key);
+    if (strncmp(token, key, key_len) != 0 || token[key_len] != '=') {
+        return -1;
+    }
+    char *end = NULL;
+    *out = strtod(token + key_len + 1, &end);
+    return (end == token + key_len + 1 || *end != '\0') ? -1 : 0;
+}
+
+// spec: "range min=<v> max=<v>" | "rate max=<per sec>" | "status <STATUS>"
+//     | "geofence lat=<deg> lon=<deg> radius=<m>"
+int alarm_compile(char *spec, telemetry_data_type type, alarm_rule *out) {
+    char *cursor = spec;
+    char *kind = conf_next_token(&cursor);
+    bool scalar = type == DATA_TYPE_TEMPERATURE || type == DATA_TYPE_PRESSURE || type == DATA_TYPE_HUMIDITY;
+    char *token;
+
+    if (kind == NULL) {
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    if (strcmp(kind, "range") == 0 && scalar) {
+        double min = -INFINITY, max = INFINITY;
+        while ((token = conf_next_token(&cursor)) != NULL) {
+            if (parse_key_double(token, "min", &min) < 0 && parse_key_double(token, "max", &max) < 0) {
+                return -1;
+            }
+        }
+        if (min > max) {
+            return -1;
+        }
+        out->kind = ALARM_RANGE;
+        out->u.range.min = (float)min;
+        out->u.range.max = (float)max;
+    } else if (strcmp(kind, "rate") == 0 && scalar) {
+        double max = -1.0;
+        token = conf_next_token(&cursor);
+        if (token == NULL || parse_key_double(token, "max", &max) < 0 || max < 0.0) {
+            return -1;
+        }
+        out->kind = ALARM_RATE;
+        out->u.rate.max_per_sec = (float)max;
+    } else if (strcmp(kind, "status") == 0 && type == DATA_TYPE_STATUS) {
+        token = conf_next_token(&cursor);
+        if (token == NULL || strlen(token) >= ALARM_STATUS_SIZE) {
+            return -1;
+        }
+        out->kind = ALARM_STATUS;
+        strcpy(out->u.status, token);
+    } else if (strcmp(kind, "geofence") == 0 && type == DATA_TYPE_GPS) {
+        double lat = NAN, lon = NAN, radius = -1.0;
+        while ((token = conf_next_token(&cursor)) != NULL) {
+            if (parse_key_double(token, "lat", &lat) < 0 &&
+                parse_key_double(token, "lon", &lon) < 0 &&
+                parse_key_double(token, "radius", &radius) < 0) {
+                return -1;
+            }
+        }
+        if (isnan(lat) || isnan(lon) || radius < 0.0) {
+            return -1;
+        }
+        out->kind = ALARM_GEOFENCE;
+        out->u.fence.lat = lat;
+        out->u.fence.lon = lon;
+        out->u.fence.radius_m = radius;
+    } else {
+        return -1;
+    }
+    return conf_next_token(&cursor) == NULL ? 0 : -1;
+}
+
+int alarm_describe(const alarm_rule *rule, char *buf, size_t size) {
+    switch (rule->kind) {
+        case ALARM_RANGE:
+            return snprintf(buf, size, "range min=%g max=%g", rule->u.range.min, rule->u.range.max);
+        case ALARM_RATE:
+            return snprintf(buf, size, "rate max=%g", rule->u.rate.max_per_sec);
+        case ALARM_STATUS:
+            return snprintf(buf, size, "status %s", rule->u.status);
+        case ALARM_GEOFENCE:
+            return snprintf(buf, size, "geofence lat=%g lon=%g radius=%g",
+                            rule->u.fence.lat, rule->u.fence.lon, rule->u.fence.radius_m);
+    }
+    return snprintf(buf, size, "unknown");
+}
+
+int alarm_table_add(alarm_table *table, const alarm_rule *rule) {
+    if (table->count >= ALARM_MAX_RULES) {
+        return -1;
+    }
+    table->rules[table->count] = *rule;
+    table->rules[table->count].raised = false;
+    table->count++;
+    return 0;
+}
+
+void alarm_table_clear(alarm_table *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+static void push_event(const alarm_event *event) {
+    pthread_mutex_lock(&ring_mutex);
+    if (ring_count == ALARM_RING_SIZE) {
+        ring_head = (ring_head + 1) % ALARM_RING_SIZE; // drop the oldest
+        ring_count--;
+        ring_dropped++;
+    }
+    ring[(ring_head + ring_count) % ALARM_RING_SIZE] = *event;
+    ring_count++;
+    pthread_mutex_unlock(&ring_mutex);
+
+    if (wake_pipe[1] >= 0) {
+        char byte = 1;
+        ssize_t ignored = write(wake_pipe[1], &byte, 1); // full pipe already means "wake up"
+        (void)ignored;
+    }
+}
+
+static float scalar_value(const telemetry_data *data) {
+    switch (data->type) {
+        case DATA_TYPE_TEMPERATURE: return data->value.temperature;
+        case DATA_TYPE_PRESSURE: return data->value.pressure;
+        case DATA_TYPE_HUMIDITY: return data->value.humidity;
+        default: return 0.0f;
+    }
+}
+
+static double fence_distance_m(const alarm_rule *rule, const gps_data *gps) {
+    double mean_lat = (gps->latitude + rule->u.fence.lat) / 2.0 * DEG_TO_RAD;
+    double x = (gps->longitude - rule->u.fence.lon) * DEG_TO_RAD * cos(mean_lat);
+    double y = (gps->latitude - rule->u.fence.lat) * DEG_TO_RAD;
+    return EARTH_RADIUS_M * sqrt(x * x + y * y);
+}
+
+static bool same_rule(const alarm_rule *a, const alarm_rule *b) {
+    // alarm_compile zeroes the rule first, so the padding compares too.
+    return a->kind == b->kind && memcmp(&a->u, &b->u, sizeof(a->u)) == 0;
+}
+
+// Swaps in the rules of `next`. A raised rule that `next` keeps at the
+// same index stays raised; every other raised rule is cleared with an
+// event, so subscribers do not keep an alarm that nothing will clear.
+// Caller serializes access to the table (sources_mutex).
+void alarm_table_replace(alarm_table *table, const alarm_table *next, int source_id) {
+    alarm_table old = *table;
+    *table = *next;
+    table->has_prev = old.has_prev;
+    table->prev_value = old.prev_value;
+    table->prev_ts = old.prev_ts;
+
+    long long now = get_current_time_ms();
+    for (int i = 0; i < old.count; ++i) {
+        if (!old.rules[i].raised) {
+            continue;
+        }
+        if (i < table->count && same_rule(&old.rules[i], &table->rules[i])) {
+            table->rules[i].raised = true;
+            continue;
+        }
+        alarm_event event = {
+            .source_id = source_id,
+            .rule_index = (uint8_t)i,
+            .kind = (uint8_t)old.rules[i].kind,
+            .raised = 0,
+            .timestamp_ms = now,
+            .value = 0.0,
+        };
+        push_event(&event);
+    }
+}
+
+// Caller serializes access to the table (sources_mutex).
+void alarm_evaluate(alarm_table *table, const telemetry_data *data) {
+    if (table->count == 0) {
+        return;
+    }
+    float value = scalar_value(data);
+
+    for (int i = 0; i < table->count; ++i) {
+        alarm_rule *rule = &table->rules[i];
+        bool condition = false;
+        double reported = value;
+
+        switch (rule->kind) {
+            case ALARM_RANGE:
+                condition = value < rule->u.range.min || value > rule->u.range.max;
+                break;
+            case ALARM_RATE: {
+                if (!table->has_prev || data->timestamp_ms <= table->prev_ts) {
+                    continue;
+                }
+                double dt = (double)(data->timestamp_ms - table->prev_ts) / 1000.0;
+                reported = fabs((double)(value - table->prev_value)) / dt;
+                condition = reported > rule->u.rate.max_per_sec;
+                break;
+            }
+            case ALARM_STATUS:
+                condition = strncmp(data->value.status, rule->u.status, ALARM_STATUS_SIZE) == 0;
+                reported = 0.0;
+                break;
+            case ALARM_GEOFENCE:
+                reported = fence_distance_m(rule, &data->value.gps);
+                condition = reported > rule->u.fence.radius_m;
+                break;
+        }
+
+        if (condition != rule->raised) {
+            rule->raised = condition;
+            alarm_event event = {
+                .source_id = data->id,
+                .rule_index = (uint8_t)i,
+                .kind = (uint8_t)rule->kind,
+                .raised = condition ? 1 : 0,
+                .timestamp_ms = data->timestamp_ms,
+                .value = reported,
+            };
+            push_event(&event);
+        }
+    }
+
+    table->has_prev = true;
+    table->prev_value = value;
+    table->prev_ts = data->timestamp_ms;
+}
+
+size_t alarm_drain(alarm_event *out, size_t max) {
+    pthread_mutex_lock(&ring_mutex);
+    size_t n = ring_count < max ? ring_count : max;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = ring[(ring_head + i) % ALARM_RING_SIZE];
+    }
+    ring_head = (ring_head + n) % ALARM_RING_SIZE;
+    ring_count -= n;
+    pthread_mutex_unlock(&ring_mutex);
+    return n;
+}
+
+void alarm_clear_wakeup(void) {
+    char sink[64];
+    while (wake_pipe[0] >= 0 && read(wake_pipe[0], sink, sizeof(sink)) > 0) {
+    }
+}
+
+unsigned long long alarm_dropped(void) {
+    pthread_mutex_lock(&ring_mutex);
+    unsigned long long dropped = ring_dropped;
+    pthread_mutex_unlock(&ring_mutex);
+    return dropped;
+}
+
+ssize_t serialize_alarm_event(const alarm_event *event, unsigned char *buffer, size_t buffer_size) {
+    if (buffer_size < ALARM_EVENT_SIZE) {
+        return -1;
+    }
+    size_t offset = 0;
+    buffer[offset++] = 'E';
+
+    uint32_t net_id = htonl((uint32_t)event->source_id);
+    memcpy(buffer + offset, &net_id, sizeof(net_id));
+    offset += sizeof(net_id);
+
+    buffer[offset++] = event->rule_index;
+    buffer[offset++] = event->kind;
+    buffer[offset++] = event->raised;
+
+    uint64_t net_timestamp = htonll((uint64_t)event->timestamp_ms);
+    memcpy(buffer + offset, &net_timestamp, sizeof(net_timestamp));
+    offset += sizeof(net_timestamp);
+
+    uint64_t net_value = htond(event->value);
+    memcpy(buffer + offset, &net_value, sizeof(net_value));
+    offset += sizeof(net_value);
+
+    return (ssize_t)offset;
+}
@@ -0,0 +1,75 @@
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+// Threshold rules are compiled into a fixed per-source table and checked
+// right after every reading. Only transitions produce events: a rule is
+// raised when its condition starts to hold and cleared when it stops.
+// Events are queued in a ring and the poll loop is woken through a pipe.
+//
+// Event record: 'E', uint32 source id, uint8 rule index, uint8 kind,
+// uint8 raised, uint64 timestamp_ms, double value (reading, rate per
+// second or distance from the fence centre in meters).
+
+#define ALARM_MAX_RULES 4
+#define ALARM_STATUS_SIZE 20
+#define ALARM_RING_SIZE 1024
+#define ALARM_EVENT_SIZE 24
+
+typedef enum {
+    ALARM_RANGE,
+    ALARM_RATE,
+    ALARM_STATUS,
+    ALARM_GEOFENCE
+} alarm_kind;
+
+typedef struct alarm_rule {
+    alarm_kind kind;
+    bool raised;
+    union {
+        struct { float min, max; } range;
+        struct { float max_per_sec; } rate;
+        char status[ALARM_STATUS_SIZE];
+        struct { double lat, lon, radius_m; } fence;
+    } u;
+} alarm_rule;
+
+typedef struct alarm_table {
+    alarm_rule rules[ALARM_MAX_RULES];
+    int count;
+    bool has_prev;
+    float prev_value;
+    long long prev_ts;
+} alarm_table;
+
+typedef struct alarm_event {
+    int source_id;
+    uint8_t rule_index;
+    uint8_t kind;
+    uint8_t raised;
+    long long timestamp_ms;
+    double value;
+} alarm_event;
+
+int alarm_init(void);
+void alarm_shutdown(void);
+
+int alarm_compile(char *spec, telemetry_data_type type, alarm_rule *out);
+int alarm_describe(const alarm_rule *rule, char *buf, size_t size);
+int alarm_table_add(alarm_table *table, const alarm_rule *rule);
+void alarm_table_clear(alarm_table *table);
+void alarm_table_replace(alarm_table *table, const alarm_table *next, int source_id);
+void alarm_evaluate(alarm_table *table, const telemetry_data *data);
+
+size_t alarm_drain(alarm_event *out, size_t max);
+void alarm_clear_wakeup(void);
+unsigned long long alarm_dropped(void);
+ssize_t serialize_alarm_event(const alarm_event *event, unsigned char *buffer, size_t buffer_size);
+
+#endif // ALARM_H
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "broadcast.h"
+#include "alarm.h"
+#include "compress.h"
+#include "registry.h"
+#include "server_utils.h"
+#include "telemetry.h"
+
+#define RECORD_BUFFER_SIZE 64
+
+static tick_frame frame = {0};
+static size_t tick_budget = 0; // bytes per tick over all clients, 0 - unlimited
+static size_t rr_start[CLIENT_PRIO_COUNT];
+static unsigned long tick_serial = 0; // tells shared compressed records of different ticks apart
+static latency_hist tick_latency; // how late the poll loop got to each tick, us
+
+void broadcast_set_budget(size_t bytes_per_tick) {
+    tick_budget = bytes_per_tick;
+}
+
+static int frame_append(tick_frame *f, const unsigned char *record, size_t len) {
+    if (f->count + 2 > f->offsets_cap) {
+        size_t new_cap = f->offsets_cap > 0 ? f->offsets_cap * 2 : 16;
+        size_t *temp = realloc(f->offsets, new_cap * sizeof(size_t));
+        if (temp == NULL) {
+            perror("realloc frame offsets");
+            return -1;
+        }
+        f->offsets = temp;
+        f->offsets_cap = new_cap;
+    }
+    if (f->len + len > f->cap) {
+        size_t new_cap = f->cap > 0 ? f->cap * 2 : 1024;
+        while (new_cap < f->len + len) {
+            new_cap *= 2;
+        }
+        unsigned char *temp = realloc(f->data, new_cap);
+        if (temp == NULL) {
+            perror("realloc frame data");
+            return -1;
+        }
+        f->data = temp;
+        f->cap = new_cap;
+    }
+    memcpy(f->data + f->len, record, len);
+    f->offsets[f->count++] = f->len;
+    f->len += len;
+    f->offsets[f->count] = f->len;
+    return 0;
+}
+
+static void frame_build(tick_frame *f) {
+    unsigned char record[RECORD_BUFFER_SIZE];
+
+    f->len = 0;
+    f->count = 0;
+
+    source_table *table = registry_read_lock();
+    size_t count = table != NULL ? table->count : 0;
+    for (size_t k = 0; k < count; ++k) {
+        virtual_source *source = &table->entries[k]->source;
+        telemetry_data data;
+        bool is_active = false;
+
+        pthread_mutex_lock(&sources_mutex);
+        if (source->is_active) {
+            data = source->data;
+            is_active = true;
+        }
+        pthread_mutex_unlock(&sources_mutex);
+
+        if (!is_active) continue;
+
+        ssize_t bytes = serialize_telemetry_data(&data, record, sizeof(record));
+        if (bytes <= 0) {
+            continue;
+        }
+        if (frame_append(f, record, (size_t)bytes) < 0) {
+            break;
+        }
+    }
+    registry_read_unlock();
+}
+
+static double min_double(double a, double b) {
+    return a < b ? a : b;
+}
+
+// A compressing client takes its level's shared record of the frame whole
+// or not at all, and only while it is in step with the stream: after a
+// missed frame it waits for the next restart. Buckets may run into debt
+// for one frame so that limits below a frame still average out to the
+// configured rate.
+static void schedule_compressed(client_conn *conn, size_t *budget_left) {
+    compress_record *record = compress_stream_frame(conn->compressor, tick_serial, frame.data, frame.len);
+    if (record == NULL) {
+        conn->compress_in_step = false;
+        conn->stats.records_shed += frame.count;
+        return;
+    }
+    if (!conn->compress_in_step && !compress_record_restarts(record)) {
+        conn->stats.records_shed += frame.count;
+        return;
+    }
+
+    size_t len = record->len;
+    if ((tick_budget > 0 && *budget_left < len) || conn->outlen + len > CLIENT_OUTBUF_MAX) {
+        conn->compress_in_step = false;
+        conn->stats.records_shed += frame.count;
+        return;
+    }
+    if (!token_bucket_has(&conn->record_bucket, min_double((double)frame.count, conn->record_bucket.rate)) ||
+        !token_bucket_has(&conn->byte_bucket, min_double((double)len, conn->byte_bucket.rate))) {
+        conn->compress_in_step = false;
+        conn->stats.records_throttled += frame.count;
+        return;
+    }
+
+    compress_record_hold(record);
+    if (client_queue_ref(conn, record->data, len, record, compress_record_release) < 0) {
+        conn->compress_in_step = false;
+        conn->stats.records_shed += frame.count;
+        return;
+    }
+    conn->compress_in_step = true;
+    token_bucket_consume(&conn->record_bucket, (double)frame.count);
+    token_bucket_consume(&conn->byte_bucket, (double)len);
+    if (tick_budget > 0) {
+        *budget_left -= len;
+    }
+    conn->stats.records_sent += frame.count;
+    conn->stats.bytes_sent += len;
+    conn->stats.bytes_raw += frame.len;
+}
+
+// Queues the client's share of the frame, starting where the previous tick
+// stopped so that a limited client still sees every source over time.
+static void schedule_client(client_conn *conn, long long now_ms, size_t *budget_left) {
+    token_bucket_refill(&conn->record_bucket, now_ms);
+    token_bucket_refill(&conn->byte_bucket, now_ms);
+
+    if (conn->compressor != NULL) {
+        schedule_compressed(conn, budget_left);
+        return;
+    }
+
+    size_t sent = 0;
+    bool shed = false;
+    for (; sent < frame.count; ++sent) {
+        size_t k = (conn->frame_cursor + sent) % frame.count;
+        size_t len = frame.offsets[k + 1] - frame.offsets[k];
+
+        if (tick_budget > 0 && *budget_left < len) {
+            shed = true;
+            break;
+        }
+        // Limits below one record still let it through now and then.
+        if (!token_bucket_has(&conn->record_bucket, min_double(1.0, conn->record_bucket.rate)) ||
+            !token_bucket_has(&conn->byte_bucket, min_double((double)len, conn->byte_bucket.rate))) {
+            break;
+        }
+        if (client_queue(conn, frame.data + frame.offsets[k], len) < 0) {
+            shed = true;
+            break;
+        }
+        token_bucket_consume(&conn->record_bucket, 1.0);
+        token_bucket_consume(&conn->byte_bucket, (double)len);
+        if (tick_budget > 0) {
+            *budget_left -= len;
+        }
+        conn->stats.bytes_sent += len;
+        conn->stats.bytes_raw += len;
+    }
+
+    size_t missed = frame.count - sent;
+    if (shed) {
+        conn->stats.records_shed += missed;
+    } else {
+        conn->stats.records_throttled += missed;
+    }
+    conn->stats.records_sent += sent;
+    conn->frame_cursor = (conn->frame_cursor + sent) % frame.count;
+}
+
+void broadcast_tick(client_conn **conns, nfds_t nfds) {
+    frame_build(&frame);
+    if (frame.count == 0 || nfds <= POLL_RESERVED_FDS) {
+        return;
+    }
+
+    long long now_ms = monotonic_ms();
+    size_t budget_left = tick_budget;
+    size_t clients = nfds - POLL_RESERVED_FDS;
+
+    // Shared streams decide on a restart from who is waiting for one.
+    tick_serial++;
+    for (nfds_t j = POLL_RESERVED_FDS; j < nfds; ++j) {
+        client_conn *conn = conns[j];
+        if (conn != NULL && !conn->closing && conn->compressor != NULL &&
+            (conn->subscriptions & CLIENT_SUB_STREAM)) {
+            compress_stream_note_peer(conn->compressor, conn->compress_in_step);
+        }
+    }
+
+    for (int prio = 0; prio < CLIENT_PRIO_COUNT; ++prio) {
+        for (size_t j = 0; j < clients; ++j) {
+            client_conn *conn = conns[POLL_RESERVED_FDS + (rr_start[prio] + j) % clients];
+            if (conn == NULL || conn->closing || conn->priority != (client_priority)prio ||
+                !(conn->subscriptions & CLIENT_SUB_STREAM)) {
+                continue;
+            }
+            schedule_client(conn, now_ms, &budget_left);
+        }
+        rr_start[prio]++;
+    }
+}
+
+// Alarm events are rare and urgent: they go out as soon as the poll loop
+// is woken, outside the tick budget and the clients' rate limits.
+void broadcast_events(client_conn **conns, nfds_t nfds) {
+    static alarm_event events[ALARM_RING_SIZE];
+    unsigned char record[ALARM_EVENT_SIZE];
+
+    size_t count = alarm_drain(events, ALARM_RING_SIZE);
+    for (size_t k = 0; k < count; ++k) {
+        ssize_t len = serialize_alarm_event(&events[k], record, sizeof(record));
+        if (len <= 0) {
+            continue;
+        }
+        for (nfds_t j = POLL_RESERVED_FDS; j < nfds; ++j) {
+            client_conn *conn = conns[j];
+            if (conn == NULL || conn->closing || !(conn->subscriptions & CLIENT_SUB_EVENTS)) {
+                continue;
+            }
+            if (client_queue(conn, record, (size_t)len) < 0) {
+                conn->stats.events_shed++;
+                continue;
+            }
+            conn->stats.events_sent++;
+            conn->stats.bytes_sent += (size_t)len;
+            conn->stats.bytes_raw += (size_t)len;
+        }
+    }
+}
+
+void broadcast_record_lateness(long long late_ms) {
+    latency_record(&tick_latency, late_ms * 1000);
+}
+
+void broadcast_tick_latency(latency_summary *summary) {
+    latency_add(summary, &tick_latency);
+}
+
+void broadcast_reset_latency(void) {
+    latency_reset(&tick_latency);
+}
+
+void broadcast_cleanup(void) {
+    free(frame.data);
+    free(frame.offsets);
+    memset(&frame, 0, sizeof(frame));
+}
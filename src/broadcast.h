@@ -0,0 +1,32 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <poll.h>
+#include <stddef.h>
+
+#include "client.h"
+#include "latency.h"
+
+#define TICK_INTERVAL_MS 1000
+#define BROADCAST_MIN_BUDGET 1024 // a tick budget below a few records starves every client
+
+// All active sources serialized once per tick, shared by every client.
+typedef struct tick_frame {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    size_t *offsets; // start of record i; offsets[count] == len
+    size_t count;
+    size_t offsets_cap;
+} tick_frame;
+
+void broadcast_set_budget(size_t bytes_per_tick);
+void broadcast_tick(client_conn **conns, nfds_t nfds);
+void broadcast_events(client_conn **conns, nfds_t nfds);
+void broadcast_cleanup(void);
+
+void broadcast_record_lateness(long long late_ms);
+void broadcast_tick_latency(latency_summary *summary);
+void broadcast_reset_latency(void);
+
+#endif // BROADCAST_H
@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "client.h"
+#include "control.h"
+#include "pool.h"
+#include "compress.h"
+
+#define CONN_POOL_SLAB 64
+#define CHUNK_POOL_SLAB 64
+
+static mem_pool *conn_pool = NULL;
+static mem_pool *chunk_pool = NULL;
+
+// `node` is where the I/O thread runs, -1 - plain heap.
+int client_pools_init(int node) {
+    conn_pool = pool_create_on_node("client_conn", sizeof(client_conn), CONN_POOL_SLAB, node);
+    chunk_pool = pool_create_on_node("out_chunk", sizeof(out_chunk), CHUNK_POOL_SLAB, node);
+    if (conn_pool == NULL || chunk_pool == NULL) {
+        client_pools_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+void client_pools_destroy(void) {
+    pool_destroy(chunk_pool);
+    pool_destroy(conn_pool);
+    chunk_pool = NULL;
+    conn_pool = NULL;
+}
+
+// Returns NULL when the memory budget is spent; the caller refuses the peer.
+client_conn *client_conn_create(int fd) {
+    client_conn *conn = pool_alloc(conn_pool);
+    if (conn == NULL) {
+        fprintf(stderr, "No memory budget left for client fd=%d\n", fd);
+        return NULL;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+    conn->priority = CLIENT_PRIO_NORMAL;
+    conn->subscriptions = CLIENT_SUB_STREAM;
+    return conn;
+}
+
+static void chunk_free(out_chunk *chunk) {
+    if (chunk->ref != NULL) {
+        chunk->ref_release(chunk->ref_owner);
+    }
+    pool_free(chunk_pool, chunk);
+}
+
+static size_t chunk_room(const out_chunk *chunk) {
+    return chunk->ref != NULL ? 0 : sizeof(chunk->data) - chunk->end;
+}
+
+void client_conn_destroy(client_conn *conn) {
+    if (conn == NULL) {
+        return;
+    }
+    compress_stream_release(conn->compressor);
+    out_chunk *chunk = conn->out_head;
+    while (chunk != NULL) {
+        out_chunk *next = chunk->next;
+        chunk_free(chunk);
+        chunk = next;
+    }
+    pool_free(conn_pool, conn);
+}
+
+static const char *priority_names[CLIENT_PRIO_COUNT] = {"critical", "normal", "bulk"};
+
+const char *client_priority_name(client_priority priority) {
+    return priority < CLIENT_PRIO_COUNT ? priority_names[priority] : "unknown";
+}
+
+int client_parse_priority(const char *name, client_priority *priority) {
+    for (int i = 0; i < CLIENT_PRIO_COUNT; ++i) {
+        if (strcmp(name, priority_names[i]) == 0) {
+            *priority = (client_priority)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Appends to the outgoing queue. Fails instead of growing past
+// CLIENT_OUTBUF_MAX or the pool budget, so the caller sheds the data.
+int client_queue(client_conn *conn, const void *data, size_t len) {
+    const unsigned char *src = data;
+
+    if (conn->outlen + len > CLIENT_OUTBUF_MAX) {
+        return -1;
+    }
+
+    size_t tail_room = conn->out_tail != NULL ? chunk_room(conn->out_tail) : 0;
+    if (len > tail_room) {
+        size_t needed = (len - tail_room + sizeof(conn->out_tail->data) - 1) / sizeof(conn->out_tail->data);
+        out_chunk *first = NULL, *last = NULL;
+        for (size_t i = 0; i < needed; ++i) {
+            out_chunk *chunk = pool_alloc(chunk_pool);
+            if (chunk == NULL) {
+                while (first != NULL) {
+                    out_chunk *next = first->next;
+                    pool_free(chunk_pool, first);
+                    first = next;
+                }
+                return -1;
+            }
+            chunk->next = NULL;
+            chunk->start = chunk->end = 0;
+            chunk->ref = NULL;
+            if (last != NULL) {
+                last->next = chunk;
+            } else {
+                first = chunk;
+            }
+            last = chunk;
+        }
+        if (conn->out_tail != NULL) {
+            conn->out_tail->next = first;
+        } else {
+            conn->out_head = first;
+        }
+    }
+
+    out_chunk *chunk = conn->out_tail != NULL ? conn->out_tail : conn->out_head;
+    size_t left = len;
+    while (left > 0) {
+        size_t room = chunk_room(chunk);
+        if (room == 0) {
+            chunk = chunk->next;
+            continue;
+        }
+        size_t n = left < room ? left : room;
+        memcpy(chunk->data + chunk->end, src, n);
+        chunk->end += n;
+        src += n;
+        left -= n;
+        conn->out_tail = chunk;
+    }
+    conn->outlen += len;
+    return 0;
+}
+
+// Queues a shared buffer without copying it and outside CLIENT_OUTBUF_MAX.
+// Takes over one reference: `release` runs once the buffer is sent or the
+// connection goes away, and also when queueing fails.
+int client_queue_ref(client_conn *conn, const unsigned char *data, size_t len,
+                     void *owner, void (*release)(void *owner)) {
+    out_chunk *chunk = pool_alloc(chunk_pool);
+    if (chunk == NULL) {
+        release(owner);
+        return -1;
+    }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = len;
+    chunk->ref = data;
+    chunk->ref_owner = owner;
+    chunk->ref_release = release;
+
+    if (conn->out_tail != NULL) {
+        conn->out_tail->next = chunk;
+    } else {
+        conn->out_head = chunk;
+    }
+    conn->out_tail = chunk;
+    conn->outlen += len;
+    return 0;
+}
+
+// Writes as much of the queue as the socket takes without blocking.
+int client_flush(client_conn *conn) {
+    if (conn->closing) {
+        return -1;
+    }
+    while (conn->out_head != NULL) {
+        struct iovec iov[OUT_CHUNK_IOV];
+        int iovcnt = 0;
+        for (out_chunk *c = conn->out_head; c != NULL && iovcnt < OUT_CHUNK_IOV; c = c->next) {
+            iov[iovcnt].iov_base = (void *)((c->ref != NULL ? c->ref : c->data) + c->start);
+            iov[iovcnt].iov_len = c->end - c->start;
+            iovcnt++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t bytes_sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            perror("send");
+            conn->closing = true;
+            return -1;
+        }
+
+        size_t left = (size_t)bytes_sent;
+        conn->outlen -= left;
+        while (left > 0 || (conn->out_head != NULL && conn->out_head->start == conn->out_head->end)) {
+            out_chunk *head = conn->out_head;
+            size_t avail = head->end - head->start;
+            size_t n = left < avail ? left : avail;
+            head->start += n;
+            left -= n;
+            if (head->start == head->end) {
+                conn->out_head = head->next;
+                if (conn->out_head == NULL) {
+                    conn->out_tail = NULL;
+                }
+                chunk_free(head);
+            }
+        }
+    }
+    return 0;
+}
+
+bool client_has_pending(const client_conn *conn) {
+    return conn->outlen > 0;
+}
+
+// Reads whatever is pending on the socket and runs every complete
+// newline-terminated command. Returns recv() result.
+ssize_t client_read_commands(client_conn *conn) {
+    ssize_t bytes_received = recv(conn->fd, conn->inbuf + conn->inlen,
+                                  sizeof(conn->inbuf) - conn->inlen - 1, 0);
+    if (bytes_received <= 0) {
+        return bytes_received;
+    }
+    conn->inlen += (size_t)bytes_received;
+
+    size_t start = 0;
+    for (size_t i = 0; i < conn->inlen; ++i) {
+        if (conn->inbuf[i] != '\n') {
+            continue;
+        }
+        conn->inbuf[i] = '\0';
+        if (i > start && conn->inbuf[i - 1] == '\r') {
+            conn->inbuf[i - 1] = '\0';
+        }
+        control_handle_line(conn, conn->inbuf + start);
+        start = i + 1;
+    }
+
+    if (start > 0) {
+        memmove(conn->inbuf, conn->inbuf + start, conn->inlen - start);
+        conn->inlen -= start;
+    } else if (conn->inlen == sizeof(conn->inbuf) - 1) {
+        fprintf(stderr, "Client fd=%d: command line too long, dropped\n", conn->fd);
+        conn->inlen = 0;
+    }
+    return bytes_received;
+}
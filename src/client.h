@@ -0,0 +1,84 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "ratelimit.h"
+
+#define CLIENT_INBUF_SIZE 256
+#define CLIENT_OUTBUF_MAX (64 * 1024)
+#define OUT_CHUNK_SIZE 4096
+#define OUT_CHUNK_IOV 16
+
+// Served in this order when a tick does not fit its budget.
+typedef enum {
+    CLIENT_PRIO_CRITICAL,
+    CLIENT_PRIO_NORMAL,
+    CLIENT_PRIO_BULK,
+    CLIENT_PRIO_COUNT
+} client_priority;
+
+// What a client receives: the tick stream of readings, alarm events or both.
+#define CLIENT_SUB_STREAM 0x1
+#define CLIENT_SUB_EVENTS 0x2
+
+typedef struct client_stats {
+    unsigned long long records_sent;
+    unsigned long long bytes_sent;        // on the wire
+    unsigned long long bytes_raw;         // before compression
+    unsigned long long records_throttled; // held back by the client's own limits
+    unsigned long long records_shed;      // dropped: tick budget spent or queue full
+    unsigned long long events_sent;
+    unsigned long long events_shed;       // queue full
+} client_stats;
+
+// Output is queued as a chain of fixed-size chunks from a shared pool. A
+// chunk can instead point at a shared, refcounted buffer (`ref`), which is
+// released once sent.
+typedef struct out_chunk {
+    struct out_chunk *next;
+    size_t start;
+    size_t end;
+    const unsigned char *ref;
+    void *ref_owner;
+    void (*ref_release)(void *owner);
+    unsigned char data[OUT_CHUNK_SIZE - 4 * sizeof(void *) - 2 * sizeof(size_t) - sizeof(void (*)(void *))];
+} out_chunk;
+
+typedef struct client_conn {
+    int fd;
+    bool closing;
+    char inbuf[CLIENT_INBUF_SIZE];
+    size_t inlen;
+    out_chunk *out_head;
+    out_chunk *out_tail;
+    size_t outlen;
+    client_priority priority;
+    int compress_level; // 0 - plain 'T' records
+    struct compress_stream *compressor; // shared by every client on the level
+    bool compress_in_step; // got every frame since the last restart
+    unsigned subscriptions; // CLIENT_SUB_*
+    token_bucket record_bucket;
+    token_bucket byte_bucket;
+    size_t frame_cursor;
+    client_stats stats;
+} client_conn;
+
+int client_pools_init(int node);
+void client_pools_destroy(void);
+
+client_conn *client_conn_create(int fd);
+void client_conn_destroy(client_conn *conn);
+ssize_t client_read_commands(client_conn *conn);
+int client_queue(client_conn *conn, const void *data, size_t len);
+int client_queue_ref(client_conn *conn, const unsigned char *data, size_t len,
+                     void *owner, void (*release)(void *owner));
+int client_flush(client_conn *conn);
+bool client_has_pending(const client_conn *conn);
+
+const char *client_priority_name(client_priority priority);
+int client_parse_priority(const char *name, client_priority *priority);
+
+#endif // CLIENT_H
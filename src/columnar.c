@@ -0,0 +1,788 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "columnar.h"
+
+#define COLUMNAR_PATH_SIZE 512
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+_Static_assert(sizeof(columnar_file_header) == 8, "file header layout");
+_Static_assert(sizeof(columnar_block_header) == 16, "block header layout");
+_Static_assert(sizeof(columnar_column_desc) == 32, "column descriptor layout");
+
+// Largest encoded block: every column at full width plus a full dictionary.
+#define COLUMNAR_BLOCK_MAX (sizeof(columnar_block_header) + \
+                            COLUMNAR_MAX_COLUMNS * sizeof(columnar_column_desc) + \
+                            COLUMNAR_MAX_COLUMNS * (COLUMNAR_BLOCK_ROWS * sizeof(uint64_t) + 8) + \
+                            COLUMNAR_DICT_MAX * COLUMNAR_STATUS_SIZE)
+
+static const char *type_names[COLUMNAR_TYPES] = {"temperature", "pressure", "humidity", "gps", "status"};
+
+const char *columnar_type_name(telemetry_data_type type) {
+    return (unsigned)type < COLUMNAR_TYPES ? type_names[type] : "unknown";
+}
+
+// ---- bit packing ----
+
+static unsigned bit_width(uint64_t max) {
+    unsigned width = 0;
+    while (max != 0) {
+        width++;
+        max >>= 1;
+    }
+    return width;
+}
+
+static size_t packed_size(size_t rows, unsigned width) {
+    return (rows * width + 63) / 64 * sizeof(uint64_t);
+}
+
+static void pack_bits(const uint64_t *in, size_t rows, unsigned width, uint64_t *out) {
+    memset(out, 0, packed_size(rows, width));
+    if (width == 0) {
+        return;
+    }
+    for (size_t i = 0; i < rows; ++i) {
+        size_t bit = i * width;
+        size_t word = bit >> 6;
+        unsigned offset = bit & 63;
+        out[word] |= in[i] << offset;
+        if (offset + width > 64) {
+            out[word + 1] |= in[i] >> (64 - offset);
+        }
+    }
+}
+
+static void unpack_bits(const uint64_t *in, size_t rows, unsigned width, uint64_t *out) {
+    if (width == 0) {
+        memset(out, 0, rows * sizeof(uint64_t));
+        return;
+    }
+    uint64_t mask = width == 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+    for (size_t i = 0; i < rows; ++i) {
+        size_t bit = i * width;
+        size_t word = bit >> 6;
+        unsigned offset = bit & 63;
+        uint64_t value = in[word] >> offset;
+        if (offset + width > 64) {
+            value |= in[word + 1] << (64 - offset);
+        }
+        out[i] = value & mask;
+    }
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)((value >> 1) ^ (~(value & 1) + 1));
+}
+
+// ---- block encoding ----
+
+typedef struct encoder {
+    unsigned char *data;
+    columnar_block_header *header;
+    columnar_column_desc *descs;
+    size_t len;
+    uint64_t scratch[COLUMNAR_BLOCK_ROWS];
+} encoder;
+
+static columnar_column_desc *encoder_column(encoder *e, columnar_column column, columnar_encoding encoding) {
+    columnar_column_desc *desc = &e->descs[e->header->columns++];
+    memset(desc, 0, sizeof(*desc));
+    desc->column = (uint8_t)column;
+    desc->encoding = (uint8_t)encoding;
+    return desc;
+}
+
+static void encoder_payload(encoder *e, columnar_column_desc *desc, const void *data, size_t bytes) {
+    size_t padded = ALIGN8(bytes);
+    if (data != NULL) {
+        memcpy(e->data + e->len, data, bytes);
+    }
+    memset(e->data + e->len + bytes, 0, padded - bytes);
+    e->len += padded;
+    desc->bytes += (uint32_t)padded;
+    e->header->payload_bytes += (uint32_t)padded;
+}
+
+static void encode_packed(encoder *e, columnar_column_desc *desc, size_t rows, uint64_t max) {
+    desc->bit_width = (uint8_t)bit_width(max);
+    size_t bytes = packed_size(rows, desc->bit_width);
+    pack_bits(e->scratch, rows, desc->bit_width, (uint64_t *)(e->data + e->len));
+    encoder_payload(e, desc, NULL, bytes);
+}
+
+static void encode_ids(encoder *e, const columnar_block *b) {
+    uint32_t min = b->ids[0], max = b->ids[0];
+    for (uint32_t i = 1; i < b->rows; ++i) {
+        if (b->ids[i] < min) min = b->ids[i];
+        if (b->ids[i] > max) max = b->ids[i];
+    }
+    columnar_column_desc *desc = encoder_column(e, COL_ID, ENC_FOR_BITPACK);
+    desc->base = min;
+    desc->min = min;
+    desc->max = max;
+    for (uint32_t i = 0; i < b->rows; ++i) {
+        e->scratch[i] = b->ids[i] - min;
+    }
+    encode_packed(e, desc, b->rows, (uint64_t)(max - min));
+}
+
+static void encode_timestamps(encoder *e, const columnar_block *b) {
+    int64_t min = b->timestamps[0], max = b->timestamps[0], prev = b->timestamps[0];
+    uint64_t widest = 0;
+    for (uint32_t i = 0; i < b->rows; ++i) {
+        int64_t ts = b->timestamps[i];
+        if (ts < min) min = ts;
+        if (ts > max) max = ts;
+        e->scratch[i] = zigzag(ts - prev);
+        widest |= e->scratch[i];
+        prev = ts;
+    }
+    columnar_column_desc *desc = encoder_column(e, COL_TIMESTAMP, ENC_DELTA_BITPACK);
+    desc->base = b->timestamps[0];
+    desc->min = (double)min;
+    desc->max = (double)max;
+    encode_packed(e, desc, b->rows, widest);
+}
+
+static void encode_f32(encoder *e, columnar_column column, const float *values, uint32_t rows) {
+    float min = values[0], max = values[0];
+    for (uint32_t i = 1; i < rows; ++i) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    columnar_column_desc *desc = encoder_column(e, column, ENC_RAW_F32);
+    desc->min = min;
+    desc->max = max;
+    encoder_payload(e, desc, values, rows * sizeof(float));
+}
+
+static void encode_f64(encoder *e, columnar_column column, const double *values, uint32_t rows) {
+    double min = values[0], max = values[0];
+    for (uint32_t i = 1; i < rows; ++i) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    columnar_column_desc *desc = encoder_column(e, column, ENC_RAW_F64);
+    desc->min = min;
+    desc->max = max;
+    encoder_payload(e, desc, values, rows * sizeof(double));
+}
+
+static void encode_status(encoder *e, const columnar_block *b) {
+    columnar_column_desc *desc = encoder_column(e, COL_STATUS, ENC_DICT);
+    desc->base = b->dict_count;
+    desc->min = 0;
+    desc->max = b->dict_count > 0 ? b->dict_count - 1 : 0;
+    encoder_payload(e, desc, b->dict, b->dict_count * COLUMNAR_STATUS_SIZE);
+    for (uint32_t i = 0; i < b->rows; ++i) {
+        e->scratch[i] = b->status_codes[i];
+    }
+    encode_packed(e, desc, b->rows, (uint64_t)desc->max);
+}
+
+// Lays out header, descriptors and payload in e->data; returns the size.
+static size_t encode_block(encoder *e, const columnar_block *b) {
+    e->header = (columnar_block_header *)e->data;
+    memcpy(e->header->magic, "TBLK", 4);
+    e->header->rows = b->rows;
+    e->header->columns = 0;
+    e->header->payload_bytes = 0;
+    e->descs = (columnar_column_desc *)(e->data + sizeof(columnar_block_header));
+
+    size_t columns = b->type == DATA_TYPE_GPS ? 4 : 3;
+    e->len = sizeof(columnar_block_header) + columns * sizeof(columnar_column_desc);
+
+    encode_ids(e, b);
+    encode_timestamps(e, b);
+    switch (b->type) {
+        case DATA_TYPE_GPS:
+            encode_f64(e, COL_LATITUDE, b->latitudes, b->rows);
+            encode_f64(e, COL_LONGITUDE, b->longitudes, b->rows);
+            break;
+        case DATA_TYPE_STATUS:
+            encode_status(e, b);
+            break;
+        default:
+            encode_f32(e, COL_VALUE, b->values, b->rows);
+            break;
+    }
+    return e->len;
+}
+
+// ---- reading ----
+
+int columnar_read_file_header(FILE *file, telemetry_data_type *type) {
+    columnar_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "TCOL", 4) != 0) {
+        return -1;
+    }
+    if (header.version != COLUMNAR_VERSION || header.type >= COLUMNAR_TYPES) {
+        return -1; // newer format or the other byte order
+    }
+    *type = (telemetry_data_type)header.type;
+    return 0;
+}
+
+// 1 - block header read, 0 - end of file, -1 - damaged file.
+int columnar_read_block_header(FILE *file, columnar_block_header *header, columnar_column_desc *descs) {
+    size_t n = fread(header, 1, sizeof(*header), file);
+    if (n == 0 && feof(file)) {
+        return 0;
+    }
+    if (n != sizeof(*header) || memcmp(header->magic, "TBLK", 4) != 0 ||
+        header->rows == 0 || header->rows > COLUMNAR_BLOCK_ROWS ||
+        header->columns == 0 || header->columns > COLUMNAR_MAX_COLUMNS) {
+        return -1;
+    }
+    if (fread(descs, sizeof(columnar_column_desc), header->columns, file) != header->columns) {
+        return -1;
+    }
+    return 1;
+}
+
+int columnar_skip_block(FILE *file, const columnar_block_header *header) {
+    return fseek(file, (long)header->payload_bytes, SEEK_CUR);
+}
+
+static int decode_packed(const columnar_column_desc *desc, const unsigned char *data, size_t skip,
+                         uint32_t rows, uint64_t *out) {
+    if (desc->bit_width > 64 || skip + packed_size(rows, desc->bit_width) > desc->bytes) {
+        return -1;
+    }
+    unpack_bits((const uint64_t *)(data + skip), rows, desc->bit_width, out);
+    return 0;
+}
+
+int columnar_read_block(FILE *file, const columnar_block_header *header, const columnar_column_desc *descs,
+                        columnar_block *out, unsigned char **scratch, size_t *scratch_cap) {
+    uint64_t unpacked[COLUMNAR_BLOCK_ROWS];
+    uint32_t rows = header->rows;
+
+    if (*scratch_cap < header->payload_bytes) {
+        unsigned char *temp = realloc(*scratch, header->payload_bytes);
+        if (temp == NULL) {
+            return -1;
+        }
+        *scratch = temp;
+        *scratch_cap = header->payload_bytes;
+    }
+    if (fread(*scratch, 1, header->payload_bytes, file) != header->payload_bytes) {
+        return -1;
+    }
+
+    out->rows = rows;
+    out->dict_count = 0;
+    size_t offset = 0;
+    for (uint32_t c = 0; c < header->columns; ++c) {
+        const columnar_column_desc *desc = &descs[c];
+        const unsigned char *data = *scratch + offset;
+        if ((desc->bytes & 7) != 0 || offset + desc->bytes > header->payload_bytes) {
+            return -1;
+        }
+        offset += desc->bytes;
+
+        switch (desc->encoding) {
+            case ENC_FOR_BITPACK:
+                if (desc->column != COL_ID || decode_packed(desc, data, 0, rows, unpacked) < 0) {
+                    return -1;
+                }
+                for (uint32_t i = 0; i < rows; ++i) {
+                    out->ids[i] = (uint32_t)(desc->base + (int64_t)unpacked[i]);
+                }
+                break;
+            case ENC_DELTA_BITPACK: {
+                if (desc->column != COL_TIMESTAMP || decode_packed(desc, data, 0, rows, unpacked) < 0) {
+                    return -1;
+                }
+                int64_t ts = desc->base;
+                for (uint32_t i = 0; i < rows; ++i) {
+                    ts += unzigzag(unpacked[i]);
+                    out->timestamps[i] = ts;
+                }
+                break;
+            }
+            case ENC_RAW_F32:
+                if (desc->column != COL_VALUE || desc->bytes < rows * sizeof(float)) {
+                    return -1;
+                }
+                memcpy(out->values, data, rows * sizeof(float));
+                break;
+            case ENC_RAW_F64: {
+                double *dst = desc->column == COL_LATITUDE ? out->latitudes
+                            : desc->column == COL_LONGITUDE ? out->longitudes : NULL;
+                if (dst == NULL || desc->bytes < rows * sizeof(double)) {
+                    return -1;
+                }
+                memcpy(dst, data, rows * sizeof(double));
+                break;
+            }
+            case ENC_DICT: {
+                if (desc->column != COL_STATUS || desc->base < 0 || desc->base > COLUMNAR_DICT_MAX) {
+                    return -1;
+                }
+                size_t dict_bytes = (size_t)desc->base * COLUMNAR_STATUS_SIZE;
+                if (decode_packed(desc, data, ALIGN8(dict_bytes), rows, unpacked) < 0) {
+                    return -1;
+                }
+                out->dict_count = (uint32_t)desc->base;
+                memcpy(out->dict, data, dict_bytes);
+                for (uint32_t i = 0; i < rows; ++i) {
+                    if (unpacked[i] >= out->dict_count) {
+                        return -1;
+                    }
+                    out->status_codes[i] = (uint8_t)unpacked[i];
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// ---- writer ----
+
+// Generators fill a staging block per type; full blocks go to a writer
+// thread that encodes and writes them, so disk I/O never runs under
+// sources_mutex. Blocks come from a fixed set allocated up front and are
+// recycled by the writer. When it falls behind the free list runs dry: a
+// lossless export (the simulation) waits for the writer to return a block,
+// the server drops and counts the rows instead of stalling its generators.
+static bool enabled = false;
+static bool lossless = false;
+static char *export_dir = NULL;
+static FILE *files[COLUMNAR_TYPES];
+static pthread_mutex_t staging_mutex[COLUMNAR_TYPES] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+};
+static columnar_block *staging[COLUMNAR_TYPES];
+static atomic_ullong rows_dropped[COLUMNAR_TYPES]; // read by the writer without staging_mutex
+
+static pthread_t writer_thread;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t free_cond = PTHREAD_COND_INITIALIZER; // blocks returned to free_blocks
+static columnar_block *queue_head = NULL;
+static columnar_block *queue_tail = NULL;
+static columnar_block *block_store = NULL; // COLUMNAR_POOL_BLOCKS blocks
+static columnar_block *free_blocks = NULL;  // under queue_mutex
+static bool writer_exit = false;
+static encoder *writer_encoder = NULL;
+static unsigned long long rows_written = 0;
+static unsigned long long blocks_written = 0;
+static unsigned long long bytes_written = 0;
+static bool write_failed = false;
+static unsigned long long dropped_reported = 0; // writer thread
+
+// Caller holds queue_mutex.
+static columnar_block *block_take(telemetry_data_type type) {
+    columnar_block *block = free_blocks;
+    if (block == NULL) {
+        return NULL;
+    }
+    free_blocks = block->next;
+    block->type = type;
+    block->rows = 0;
+    block->dict_count = 0;
+    block->next = NULL;
+    return block;
+}
+
+// Caller holds staging_mutex[type]. Leaves the staging slot empty when
+// the free list is; columnar_append retries on the next row.
+static void seal_locked(int type) {
+    columnar_block *block = staging[type];
+    if (block == NULL || block->rows == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    if (queue_tail != NULL) {
+        queue_tail->next = block;
+    } else {
+        queue_head = block;
+    }
+    queue_tail = block;
+    staging[type] = block_take((telemetry_data_type)type);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Caller holds staging_mutex[type]. NULL only when the export drops rows.
+static columnar_block *staging_block(int type) {
+    if (staging[type] == NULL) {
+        pthread_mutex_lock(&queue_mutex);
+        while ((staging[type] = block_take((telemetry_data_type)type)) == NULL && lossless) {
+            pthread_cond_wait(&free_cond, &queue_mutex);
+        }
+        pthread_mutex_unlock(&queue_mutex);
+    }
+    return staging[type];
+}
+
+// The timed flush passes `skip_busy`: a lossless producer waits for a free
+// block holding its staging_mutex, and only the writer can free one. A busy
+// type fills its block anyway.
+static void seal_all(bool skip_busy) {
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        if (skip_busy) {
+            if (pthread_mutex_trylock(&staging_mutex[t]) != 0) {
+                continue;
+            }
+        } else {
+            pthread_mutex_lock(&staging_mutex[t]);
+        }
+        seal_locked(t);
+        pthread_mutex_unlock(&staging_mutex[t]);
+    }
+}
+
+static int find_status_code(columnar_block *block, const char *status) {
+    for (uint32_t i = 0; i < block->dict_count; ++i) {
+        if (strncmp(block->dict[i], status, COLUMNAR_STATUS_SIZE) == 0) {
+            return (int)i;
+        }
+    }
+    if (block->dict_count == COLUMNAR_DICT_MAX) {
+        return -1;
+    }
+    memset(block->dict[block->dict_count], 0, COLUMNAR_STATUS_SIZE);
+    strncpy(block->dict[block->dict_count], status, COLUMNAR_STATUS_SIZE);
+    return (int)block->dict_count++;
+}
+
+void columnar_append(const telemetry_data *data) {
+    if (!enabled || (unsigned)data->type >= COLUMNAR_TYPES) {
+        return;
+    }
+    int t = (int)data->type;
+
+    pthread_mutex_lock(&staging_mutex[t]);
+    columnar_block *block = staging_block(t);
+    int code = 0;
+    if (block != NULL && data->type == DATA_TYPE_STATUS && (code = find_status_code(block, data->value.status)) < 0) {
+        seal_locked(t); // dictionary full, start a new block
+        block = staging_block(t);
+        code = block != NULL ? find_status_code(block, data->value.status) : -1;
+    }
+    if (block == NULL || code < 0) {
+        atomic_fetch_add_explicit(&rows_dropped[t], 1, memory_order_relaxed);
+        pthread_mutex_unlock(&staging_mutex[t]);
+        return;
+    }
+
+    uint32_t row = block->rows++;
+    block->ids[row] = (uint32_t)data->id;
+    block->timestamps[row] = data->timestamp_ms;
+    switch (data->type) {
+        case DATA_TYPE_GPS:
+            block->latitudes[row] = data->value.gps.latitude;
+            block->longitudes[row] = data->value.gps.longitude;
+            break;
+        case DATA_TYPE_STATUS:
+            block->status_codes[row] = (uint8_t)code;
+            break;
+        default:
+            block->values[row] = data->value.temperature; // same slot for every scalar type
+            break;
+    }
+    if (block->rows == COLUMNAR_BLOCK_ROWS) {
+        seal_locked(t);
+    }
+    pthread_mutex_unlock(&staging_mutex[t]);
+}
+
+static void type_file_path(int type, char *path, size_t size) {
+    snprintf(path, size, "%s/%s.tcol", export_dir, type_names[type]);
+}
+
+// A file left by an earlier run is appended to only if it is ours: same
+// magic, version and type, and whole blocks up to EOF. A torn tail would
+// hide every block appended after it from readers.
+static int check_type_file(int type) {
+    char path[COLUMNAR_PATH_SIZE];
+    type_file_path(type, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(file), &st) < 0 || st.st_size == 0) {
+        fclose(file);
+        return 0;
+    }
+
+    telemetry_data_type file_type;
+    if (columnar_read_file_header(file, &file_type) < 0 || (int)file_type != type) {
+        fprintf(stderr, "%s: not a %s column file of version %d, refusing to append\n",
+                path, type_names[type], COLUMNAR_VERSION);
+        fclose(file);
+        return -1;
+    }
+    columnar_block_header header;
+    columnar_column_desc descs[COLUMNAR_MAX_COLUMNS];
+    int ret;
+    while ((ret = columnar_read_block_header(file, &header, descs)) > 0) {
+        if (columnar_skip_block(file, &header) < 0 || ftell(file) > st.st_size) {
+            ret = -1;
+            break;
+        }
+    }
+    fclose(file);
+    if (ret < 0) {
+        fprintf(stderr, "%s: damaged or truncated block, refusing to append\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static FILE *open_type_file(int type) {
+    if (files[type] != NULL) {
+        return files[type];
+    }
+    char path[COLUMNAR_PATH_SIZE];
+    type_file_path(type, path, sizeof(path));
+    FILE *file = fopen(path, "ab");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+    // Appends to the file of an earlier run (checked by columnar_open);
+    // a new file gets its header.
+    if (fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0) {
+        columnar_file_header header = {{'T', 'C', 'O', 'L'}, COLUMNAR_VERSION, (uint8_t)type, 0};
+        if (fwrite(&header, sizeof(header), 1, file) != 1) {
+            perror(path);
+            fclose(file);
+            return NULL;
+        }
+        bytes_written += sizeof(header);
+    }
+    files[type] = file;
+    return file;
+}
+
+static void write_blocks(columnar_block *list) {
+    columnar_block *done = list;
+    columnar_block *last = NULL;
+    for (columnar_block *block = list; block != NULL; block = block->next) {
+        FILE *file = open_type_file((int)block->type);
+        if (file != NULL) {
+            size_t len = encode_block(writer_encoder, block);
+            if (fwrite(writer_encoder->data, 1, len, file) != len) {
+                if (!write_failed) {
+                    perror("write columnar block");
+                }
+                write_failed = true;
+            } else {
+                rows_written += block->rows;
+                blocks_written++;
+                bytes_written += len;
+            }
+        }
+        last = block;
+    }
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        if (files[t] != NULL) {
+            fflush(files[t]);
+        }
+    }
+    if (last != NULL) {
+        pthread_mutex_lock(&queue_mutex);
+        last->next = free_blocks;
+        free_blocks = done;
+        pthread_cond_broadcast(&free_cond);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+}
+
+unsigned long long columnar_rows_dropped(void) {
+    unsigned long long dropped = 0;
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        dropped += atomic_load_explicit(&rows_dropped[t], memory_order_relaxed);
+    }
+    return dropped;
+}
+
+// After every flush, so a writer that cannot keep up shows in the log
+// while it happens rather than at shutdown.
+static void report_dropped(void) {
+    unsigned long long dropped = columnar_rows_dropped();
+    if (dropped != dropped_reported) {
+        fprintf(stderr, "Columnar export: %llu rows dropped, writer behind (%llu in total)\n",
+                dropped - dropped_reported, dropped);
+        dropped_reported = dropped;
+    }
+}
+
+static void next_flush(struct timespec *deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += COLUMNAR_FLUSH_MS / 1000;
+    deadline->tv_nsec += (COLUMNAR_FLUSH_MS % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void *writer_thread_function(void *arg) {
+    (void)arg;
+
+    // Fixed between flushes, so full blocks of one type do not keep
+    // postponing the partial blocks of the others.
+    struct timespec deadline;
+    next_flush(&deadline);
+
+    pthread_mutex_lock(&queue_mutex);
+    while (!writer_exit) {
+        if (queue_head == NULL) {
+            if (pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&queue_mutex);
+                seal_all(true);
+                next_flush(&deadline);
+                pthread_mutex_lock(&queue_mutex);
+            }
+            continue;
+        }
+        columnar_block *list = queue_head;
+        queue_head = queue_tail = NULL;
+        pthread_mutex_unlock(&queue_mutex);
+
+        write_blocks(list);
+        report_dropped();
+
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    // Producers are gone by now: write what is left, partial blocks too.
+    seal_all(false);
+    write_blocks(queue_head);
+    queue_head = queue_tail = NULL;
+    return NULL;
+}
+
+int columnar_open(const char *dir, bool wait_for_writer) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+    export_dir = strdup(dir);
+    if (export_dir == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        if (check_type_file(t) < 0) {
+            free(export_dir);
+            export_dir = NULL;
+            return -1;
+        }
+    }
+    writer_encoder = malloc(sizeof(encoder));
+    unsigned char *data = malloc(COLUMNAR_BLOCK_MAX);
+    block_store = malloc(COLUMNAR_POOL_BLOCKS * sizeof(columnar_block));
+    if (writer_encoder == NULL || data == NULL || block_store == NULL) {
+        perror("malloc columnar writer");
+        free(export_dir);
+        free(writer_encoder);
+        free(data);
+        free(block_store);
+        export_dir = NULL;
+        writer_encoder = NULL;
+        block_store = NULL;
+        return -1;
+    }
+    writer_encoder->data = data;
+    rows_written = blocks_written = bytes_written = 0;
+    write_failed = false;
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        atomic_store(&rows_dropped[t], 0);
+    }
+    dropped_reported = 0;
+    lossless = wait_for_writer;
+    free_blocks = NULL;
+    for (int i = COLUMNAR_POOL_BLOCKS - 1; i >= 0; --i) {
+        block_store[i].next = free_blocks;
+        free_blocks = &block_store[i];
+    }
+    writer_exit = false;
+
+    // The writer must not steal SIGINT/SIGTERM/SIGHUP from the poll loop.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(&writer_thread, NULL, writer_thread_function, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to create columnar writer thread: %s\n", strerror(ret));
+        free(writer_encoder->data);
+        free(writer_encoder);
+        free(export_dir);
+        free(block_store);
+        writer_encoder = NULL;
+        export_dir = NULL;
+        block_store = NULL;
+        return -1;
+    }
+
+    enabled = true;
+    printf("Columnar export to %s/<type>.tcol, %d rows per block\n", dir, COLUMNAR_BLOCK_ROWS);
+    return 0;
+}
+
+bool columnar_enabled(void) {
+    return enabled;
+}
+
+// Call once every producer has stopped.
+void columnar_close(void) {
+    if (!enabled) {
+        return;
+    }
+    enabled = false;
+
+    pthread_mutex_lock(&queue_mutex);
+    writer_exit = true;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_join(writer_thread, NULL);
+
+    unsigned long long dropped = columnar_rows_dropped();
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        if (files[t] != NULL) {
+            fclose(files[t]);
+            files[t] = NULL;
+        }
+        staging[t] = NULL;
+    }
+    printf("Columnar export: %llu rows in %llu blocks, %llu bytes, %llu rows dropped\n",
+           rows_written, blocks_written, bytes_written, dropped);
+
+    free(writer_encoder->data);
+    free(writer_encoder);
+    writer_encoder = NULL;
+    free(block_store);
+    block_store = NULL;
+    free_blocks = NULL;
+    free(export_dir);
+    export_dir = NULL;
+}
@@ -0,0 +1,113 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "telemetry.h"
+
+// Column files for offline analytics, one per source type:
+// "<dir>/<type>.tcol". Every reading that update_source_reading produces
+// is appended; rows are grouped into blocks of up to COLUMNAR_BLOCK_ROWS.
+//
+// File:  columnar_file_header, then blocks until EOF.
+// Block: columnar_block_header, `columns` descriptors, then the column
+//        payloads in descriptor order, each `bytes` long.
+//
+// Descriptors carry min/max of the column so a scan can skip a block
+// without reading its payload. Integer columns are bit-packed (LSB first,
+// 64-bit words) with the smallest width that holds the block:
+//   ENC_FOR_BITPACK   - value - base
+//   ENC_DELTA_BITPACK - zigzag(value[i] - value[i-1]), value[-1] = base
+//   ENC_DICT          - `base` entries of 20 chars, then packed codes
+// Floats are stored as is. Everything is in host byte order; the version
+// field doubles as the byte order check.
+//
+// Rows reach the file when their block fills, at shutdown, and every
+// COLUMNAR_FLUSH_MS when partial blocks are sealed. A shorter interval makes
+// rows of slow types visible to readers sooner and loses less on a crash,
+// but writes small blocks that compress worse and give scans less to skip.
+
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_BLOCK_ROWS 4096
+#define COLUMNAR_MAX_COLUMNS 4
+#define COLUMNAR_DICT_MAX 256
+#define COLUMNAR_STATUS_SIZE 20
+#define COLUMNAR_FLUSH_MS (10 * 60 * 1000) // partial blocks are written after this long
+#define COLUMNAR_POOL_BLOCKS 16 // staging and queued blocks, about 140 KB each
+#define COLUMNAR_TYPES 5
+
+typedef enum {
+    COL_ID,
+    COL_TIMESTAMP,
+    COL_VALUE,
+    COL_LATITUDE,
+    COL_LONGITUDE,
+    COL_STATUS
+} columnar_column;
+
+typedef enum {
+    ENC_FOR_BITPACK,
+    ENC_DELTA_BITPACK,
+    ENC_RAW_F32,
+    ENC_RAW_F64,
+    ENC_DICT
+} columnar_encoding;
+
+typedef struct columnar_file_header {
+    char magic[4]; // "TCOL"
+    uint16_t version;
+    uint8_t type;  // telemetry_data_type
+    uint8_t reserved;
+} columnar_file_header;
+
+typedef struct columnar_block_header {
+    char magic[4]; // "TBLK"
+    uint32_t rows;
+    uint32_t columns;
+    uint32_t payload_bytes;
+} columnar_block_header;
+
+typedef struct columnar_column_desc {
+    uint8_t column;   // columnar_column
+    uint8_t encoding; // columnar_encoding
+    uint8_t bit_width;
+    uint8_t reserved;
+    uint32_t bytes;
+    int64_t base;
+    double min;
+    double max;
+} columnar_column_desc;
+
+// One block in decoded form; also the writer's staging area.
+typedef struct columnar_block {
+    telemetry_data_type type;
+    uint32_t rows;
+    uint32_t ids[COLUMNAR_BLOCK_ROWS];
+    int64_t timestamps[COLUMNAR_BLOCK_ROWS];
+    float values[COLUMNAR_BLOCK_ROWS];      // temperature, pressure, humidity
+    double latitudes[COLUMNAR_BLOCK_ROWS];  // gps
+    double longitudes[COLUMNAR_BLOCK_ROWS];
+    uint8_t status_codes[COLUMNAR_BLOCK_ROWS];
+    uint32_t dict_count;
+    char dict[COLUMNAR_DICT_MAX][COLUMNAR_STATUS_SIZE];
+    struct columnar_block *next; // writer queue
+} columnar_block;
+
+// With wait_for_writer columnar_append blocks until the writer frees a
+// block; otherwise rows that find no free block are dropped and counted.
+int columnar_open(const char *dir, bool wait_for_writer);
+bool columnar_enabled(void);
+void columnar_append(const telemetry_data *data);
+unsigned long long columnar_rows_dropped(void); // since columnar_open, still valid after close
+void columnar_close(void);
+
+const char *columnar_type_name(telemetry_data_type type);
+int columnar_read_file_header(FILE *file, telemetry_data_type *type);
+int columnar_read_block_header(FILE *file, columnar_block_header *header, columnar_column_desc *descs);
+int columnar_skip_block(FILE *file, const columnar_block_header *header);
+int columnar_read_block(FILE *file, const columnar_block_header *header, const columnar_column_desc *descs,
+                        columnar_block *out, unsigned char **scratch, size_t *scratch_cap);
+
+#endif // COLUMNAR_H
@@ -0,0 +1,182 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "compress.h"
+#include "pool.h"
+
+struct compress_stream {
+    z_stream stream;
+    int level;
+    unsigned users;
+    bool broken;             // a frame failed half way, the next one restarts
+    bool peers_waiting;      // since the last frame
+    bool peers_in_step;
+    unsigned long since_restart;
+    unsigned long tick;      // of `record`
+    compress_record *record; // the stream's own reference
+};
+
+static compress_stream *shared[COMPRESS_MAX_LEVEL + 1];
+
+// zlib allocations go through the pool budget; the size is kept in front.
+typedef union charged_header {
+    size_t size;
+    max_align_t align;
+} charged_header;
+
+static voidpf charged_alloc(voidpf opaque, uInt items, uInt size) {
+    (void)opaque;
+    size_t bytes = sizeof(charged_header) + (size_t)items * size;
+    if (pool_charge(bytes) < 0) {
+        return Z_NULL;
+    }
+    charged_header *h = malloc(bytes);
+    if (h == NULL) {
+        pool_uncharge(bytes);
+        return Z_NULL;
+    }
+    h->size = bytes;
+    return h + 1;
+}
+
+static void charged_free(voidpf opaque, voidpf ptr) {
+    (void)opaque;
+    charged_header *h = (charged_header *)ptr - 1;
+    pool_uncharge(h->size);
+    free(h);
+}
+
+// Returns the level's shared stream, creating it for the first user.
+// NULL for a bad level or when the memory budget cannot hold the stream.
+compress_stream *compress_stream_acquire(int level) {
+    if (level < 1 || level > COMPRESS_MAX_LEVEL) {
+        return NULL;
+    }
+    compress_stream *s = shared[level];
+    if (s != NULL) {
+        s->users++;
+        return s;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        perror("calloc compress stream");
+        return NULL;
+    }
+    s->stream.zalloc = charged_alloc;
+    s->stream.zfree = charged_free;
+    if (deflateInit2(&s->stream, level, Z_DEFLATED, -COMPRESS_WINDOW_BITS, COMPRESS_MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "deflateInit failed for level %d\n", level);
+        free(s);
+        return NULL;
+    }
+    s->level = level;
+    s->users = 1;
+    s->broken = true; // the first frame starts the stream
+    shared[level] = s;
+    return s;
+}
+
+void compress_stream_release(compress_stream *s) {
+    if (s == NULL || --s->users > 0) {
+        return;
+    }
+    shared[s->level] = NULL;
+    deflateEnd(&s->stream);
+    compress_record_release(s->record);
+    free(s);
+}
+
+// Called for every client of the stream before the tick's frame.
+void compress_stream_note_peer(compress_stream *s, bool in_step) {
+    if (in_step) {
+        s->peers_in_step = true;
+    } else {
+        s->peers_waiting = true;
+    }
+}
+
+// Worst case for one sync-flushed frame. With a small window and memLevel
+// zlib may fall back to fixed codes (9 bits a byte) or to stored blocks
+// every few KiB, so this is deflateBound's conservative formula, plus the
+// empty stored block of the flush and a byte of pending bits.
+size_t compress_bound(size_t raw_len) {
+    return COMPRESS_HEADER_SIZE + raw_len + ((raw_len + 7) >> 3) + ((raw_len + 63) >> 6) + 5 + 5 + 1;
+}
+
+static compress_record *compress_next(compress_stream *s, const unsigned char *raw, size_t raw_len) {
+    bool restart = s->broken ||
+                   (s->peers_waiting && (!s->peers_in_step || s->since_restart >= COMPRESS_RESTART_TICKS));
+    s->peers_waiting = false;
+    s->peers_in_step = false;
+
+    compress_record *r = malloc(sizeof(*r) + compress_bound(raw_len));
+    if (r == NULL) {
+        perror("malloc compressed frame");
+        return NULL;
+    }
+    if (restart) {
+        deflateReset(&s->stream);
+        s->since_restart = 0;
+        s->broken = false;
+    }
+
+    s->stream.next_in = (Bytef *)raw;
+    s->stream.avail_in = (uInt)raw_len;
+    s->stream.next_out = r->data + COMPRESS_HEADER_SIZE;
+    s->stream.avail_out = (uInt)(compress_bound(raw_len) - COMPRESS_HEADER_SIZE);
+    int ret = deflate(&s->stream, Z_SYNC_FLUSH);
+    if (ret != Z_OK || s->stream.avail_in != 0 || s->stream.avail_out == 0) {
+        fprintf(stderr, "deflate failed: %s\n", s->stream.msg != NULL ? s->stream.msg : "output buffer too small");
+        s->broken = true;
+        free(r);
+        return NULL;
+    }
+    s->since_restart++;
+
+    size_t compressed = compress_bound(raw_len) - COMPRESS_HEADER_SIZE - s->stream.avail_out;
+    uint32_t net_raw = htonl((uint32_t)raw_len);
+    uint32_t net_compressed = htonl((uint32_t)compressed);
+    r->data[0] = 'Z';
+    r->data[1] = restart ? COMPRESS_FLAG_RESTART : 0;
+    memcpy(r->data + 2, &net_raw, sizeof(net_raw));
+    memcpy(r->data + 6, &net_compressed, sizeof(net_compressed));
+    r->len = COMPRESS_HEADER_SIZE + compressed;
+    r->refs = 1;
+    return r;
+}
+
+// The tick's record of the stream: compressed on the first call of a tick,
+// the same record for the other clients. The pointer is borrowed; hold it
+// to keep it past the tick. NULL when compression failed, in which case
+// the next frame restarts the stream.
+compress_record *compress_stream_frame(compress_stream *s, unsigned long tick,
+                                       const unsigned char *raw, size_t raw_len) {
+    if (s->record != NULL && s->tick == tick) {
+        return s->record;
+    }
+    compress_record_release(s->record);
+    s->record = compress_next(s, raw, raw_len);
+    s->tick = tick;
+    return s->record;
+}
+
+bool compress_record_restarts(const compress_record *r) {
+    return (r->data[1] & COMPRESS_FLAG_RESTART) != 0;
+}
+
+void compress_record_hold(compress_record *r) {
+    r->refs++;
+}
+
+void compress_record_release(void *record) {
+    compress_record *r = record;
+    if (r != NULL && --r->refs == 0) {
+        free(r);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Tick frames for compressing clients go out as one 'Z' record:
+// tag, uint8 flags, uint32 raw length, uint32 compressed length, raw
+// deflate data.
+//
+// There is one deflate stream per level, shared by every client on that
+// level. Each tick's frame is compressed once and ends on a sync flush, so
+// later frames back-reference earlier ones, and the same bytes are queued
+// to every client. A client therefore has to get every frame from the
+// point it started at: one that has just switched on compression, or that
+// missed a frame to its limits or the tick budget, waits for a restart.
+// A restart frame (COMPRESS_FLAG_RESTART) begins a fresh stream and the
+// peer starts a new raw inflate stream on it. The stream restarts at once
+// when nobody depends on its history, otherwise at most every
+// COMPRESS_RESTART_TICKS frames.
+//
+// zlib state is charged against the pool budget (-M). Streams and records
+// belong to the poll loop thread.
+
+#define COMPRESS_DEFAULT_LEVEL 6
+#define COMPRESS_MAX_LEVEL 9
+#define COMPRESS_HEADER_SIZE 10
+#define COMPRESS_FLAG_RESTART 0x01
+#define COMPRESS_RESTART_TICKS 5
+#define COMPRESS_WINDOW_BITS 12 // 4 KiB of history keeps a stream near 32 KiB
+#define COMPRESS_MEM_LEVEL 5
+
+// One tick's 'Z' record, shared by the queues of every client that takes it.
+typedef struct compress_record {
+    unsigned refs;
+    size_t len;
+    unsigned char data[];
+} compress_record;
+
+typedef struct compress_stream compress_stream;
+
+compress_stream *compress_stream_acquire(int level);
+void compress_stream_release(compress_stream *stream);
+void compress_stream_note_peer(compress_stream *stream, bool in_step);
+compress_record *compress_stream_frame(compress_stream *stream, unsigned long tick,
+                                       const unsigned char *raw, size_t raw_len);
+
+bool compress_record_restarts(const compress_record *record);
+void compress_record_hold(compress_record *record);
+void compress_record_release(void *record);
+size_t compress_bound(size_t raw_len);
+
+#endif // COMPRESS_H
@@ -4,6 +4,10 @@
 #include <stdlib.h> 
 #include <stdio.h>  
 #include <string.h> 
+#include <ctype.h>
+
+#define CONF_LINE_SIZE 256
+#define CONF_INIT_CAPACITY 8
 
 
 static void init_temp_sensor(virtual_source *s, int id, int interval) {
@@ -15,6 +19,7 @@ static void init_temp_sensor(virtual_source *s, int id, int interval) {
     s->max_value = 40.0f;
     s->max_change = 0.5f;
     s->update_interval_ms = interval;
+    seed_source(s, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
     memset(&s->data, 0, sizeof(s->data));
 }
 
@@ -26,6 +31,7 @@ static void init_gps_sensor(virtual_source *s, int id, int interval) {
     s->gps.longitude = 37.61 + ((rand() / (double)RAND_MAX) * 0.1 - 0.05);
     s->max_gps_change = 0.001;
     s->update_interval_ms = interval;
+    seed_source(s, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
      memset(&s->data, 0, sizeof(s->data));
 }
 
@@ -45,6 +51,7 @@ static void init_gps_sensor(virtual_source *s, int id, int interval) {
     }
     s->num_statuses = count_to_copy;
     s->update_interval_ms = interval;
+    seed_source(s, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
      memset(&s->data, 0, sizeof(s->data));
 }
 
@@ -57,6 +64,7 @@ static void init_pressure_sensor(virtual_source *s, int id, int interval) {
     s->max_value = 1100.0f;
     s->max_change = 0.5f;
     s->update_interval_ms = interval;
+    seed_source(s, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
      memset(&s->data, 0, sizeof(s->data));
 }
 
@@ -69,9 +77,274 @@ static void init_humidity_sensor(virtual_source *s, int id, int interval) {
     s->max_value = 100.0f;
     s->max_change = 1.0f;
     s->update_interval_ms = interval;
+    seed_source(s, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
      memset(&s->data, 0, sizeof(s->data));
 }
 
+static const struct {
+    const char *name;
+    telemetry_data_type type;
+} type_names[] = {
+    {"temperature", DATA_TYPE_TEMPERATURE},
+    {"pressure", DATA_TYPE_PRESSURE},
+    {"humidity", DATA_TYPE_HUMIDITY},
+    {"gps", DATA_TYPE_GPS},
+    {"status", DATA_TYPE_STATUS},
+};
+
+char *conf_next_token(char **cursor) {
+    char *p = *cursor;
+    while (*p != '\0' && isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    char *start = p;
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return start;
+}
+
+static int parse_int(const char *str, int *out) {
+    char *end = NULL;
+    long value = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || value < 0 || value > 0x7fffffffL) {
+        return -1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+static int parse_float(const char *str, float *out) {
+    char *end = NULL;
+    float value = strtof(str, &end);
+    if (end == str || *end != '\0') {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+int parse_source_type(const char *name, telemetry_data_type *type) {
+    for (size_t i = 0; i < sizeof(type_names) / sizeof(type_names[0]); ++i) {
+        if (strcmp(name, type_names[i].name) == 0) {
+            *type = type_names[i].type;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *source_type_name(telemetry_data_type type) {
+    for (size_t i = 0; i < sizeof(type_names) / sizeof(type_names[0]); ++i) {
+        if (type_names[i].type == type) {
+            return type_names[i].name;
+        }
+    }
+    return "unknown";
+}
+
+int init_source(virtual_source *s, telemetry_data_type type, int id, int interval) {
+    memset(s, 0, sizeof(*s));
+    switch (type) {
+        case DATA_TYPE_TEMPERATURE: init_temp_sensor(s, id, interval); break;
+        case DATA_TYPE_PRESSURE: init_pressure_sensor(s, id, interval); break;
+        case DATA_TYPE_HUMIDITY: init_humidity_sensor(s, id, interval); break;
+        case DATA_TYPE_GPS: init_gps_sensor(s, id, interval); break;
+        case DATA_TYPE_STATUS: init_status_sensor(s, id, interval); break;
+        default: return -1;
+    }
+    return 0;
+}
+
+int apply_source_option(virtual_source *s, const char *key, const char *value) {
+    if (strcmp(key, "interval") == 0) {
+        int interval;
+        if (parse_int(value, &interval) < 0 || interval <= 0) return -1;
+        s->update_interval_ms = interval;
+    } else if (strcmp(key, "min") == 0) {
+        if (parse_float(value, &s->min_value) < 0) return -1;
+    } else if (strcmp(key, "max") == 0) {
+        if (parse_float(value, &s->max_value) < 0) return -1;
+    } else if (strcmp(key, "max_change") == 0) {
+        float change;
+        if (parse_float(value, &change) < 0 || change < 0.0f) return -1;
+        if (s->type == DATA_TYPE_GPS) {
+            s->max_gps_change = change;
+        } else {
+            s->max_change = change;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_source_options(virtual_source *s, char *options) {
+    char *cursor = options;
+    char *token;
+    while ((token = conf_next_token(&cursor)) != NULL) {
+        char *eq = strchr(token, '=');
+        if (eq == NULL) {
+            return -1;
+        }
+        *eq = '\0';
+        if (apply_source_option(s, token, eq + 1) < 0) {
+            return -1;
+        }
+    }
+    if (s->type != DATA_TYPE_GPS && s->type != DATA_TYPE_STATUS && s->min_value > s->max_value) {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_source_spec(char *spec, virtual_source *out) {
+    char *cursor = spec;
+    char *type_name = conf_next_token(&cursor);
+    char *id_str = conf_next_token(&cursor);
+    char *interval_str = conf_next_token(&cursor);
+    telemetry_data_type type;
+    int id, interval;
+
+    if (type_name == NULL || id_str == NULL || interval_str == NULL) {
+        return -1;
+    }
+    if (parse_source_type(type_name, &type) < 0 ||
+        parse_int(id_str, &id) < 0 ||
+        parse_int(interval_str, &interval) < 0 || interval <= 0) {
+        return -1;
+    }
+    if (init_source(out, type, id, interval) < 0) {
+        return -1;
+    }
+    return parse_source_options(out, cursor);
+}
+
+// "rule <id> <kind> ..." - compiled against the type of a source defined
+// earlier in the same file.
+static int parse_rule_line(char *line, const virtual_source *sources, size_t count,
+                           config_rule **rules, size_t *rule_count, size_t *rule_capacity) {
+    char *cursor = line;
+    char *id_str = conf_next_token(&cursor);
+    int id;
+
+    if (id_str == NULL || parse_int(id_str, &id) < 0) {
+        return -1;
+    }
+    const virtual_source *source = NULL;
+    for (size_t i = 0; i < count && source == NULL; ++i) {
+        if (sources[i].id == id) {
+            source = &sources[i];
+        }
+    }
+    if (source == NULL) {
+        return -1;
+    }
+
+    if (*rule_count == *rule_capacity) {
+        size_t capacity = *rule_capacity > 0 ? *rule_capacity * 2 : CONF_INIT_CAPACITY;
+        config_rule *temp = realloc(*rules, capacity * sizeof(config_rule));
+        if (temp == NULL) {
+            perror("realloc failed for rules array in conf.c");
+            return -1;
+        }
+        *rules = temp;
+        *rule_capacity = capacity;
+    }
+
+    config_rule *rule = &(*rules)[*rule_count];
+    rule->source_id = id;
+    if (alarm_compile(cursor, source->type, &rule->rule) < 0) {
+        return -1;
+    }
+    (*rule_count)++;
+    return 0;
+}
+
+source_config load_sources_config_file(const char *path) {
+    if (path == NULL) {
+        return load_sources_config();
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen sources config");
+        return (source_config){NULL, 0, NULL, 0};
+    }
+
+    size_t capacity = CONF_INIT_CAPACITY;
+    size_t count = 0;
+    virtual_source *sources_array = malloc(capacity * sizeof(virtual_source));
+    if (sources_array == NULL) {
+        perror("malloc failed for sources array in conf.c");
+        fclose(file);
+        return (source_config){NULL, 0, NULL, 0};
+    }
+
+    config_rule *rules = NULL;
+    size_t rule_count = 0, rule_capacity = 0;
+
+    char line[CONF_LINE_SIZE];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *cursor = line;
+        while (isspace((unsigned char)*cursor)) {
+            cursor++;
+        }
+        if (*cursor == '\0') {
+            continue;
+        }
+
+        if (strncmp(cursor, "rule", 4) == 0 && isspace((unsigned char)cursor[4])) {
+            if (parse_rule_line(cursor + 4, sources_array, count, &rules, &rule_count, &rule_capacity) < 0) {
+                fprintf(stderr, "%s:%d: invalid rule, skipped\n", path, line_no);
+            }
+            continue;
+        }
+
+        if (count == capacity) {
+            virtual_source *temp = realloc(sources_array, capacity * 2 * sizeof(virtual_source));
+            if (temp == NULL) {
+                perror("realloc failed for sources array in conf.c");
+                free(sources_array);
+                free(rules);
+                fclose(file);
+                return (source_config){NULL, 0, NULL, 0};
+            }
+            sources_array = temp;
+            capacity *= 2;
+        }
+
+        if (parse_source_spec(cursor, &sources_array[count]) < 0) {
+            fprintf(stderr, "%s:%d: invalid source definition, skipped\n", path, line_no);
+            continue;
+        }
+        count++;
+    }
+    fclose(file);
+
+    if (count == 0) {
+        free(sources_array);
+        free(rules);
+        return (source_config){NULL, 0, NULL, 0};
+    }
+    printf("Loaded %zu sources and %zu rules from %s\n", count, rule_count, path);
+    return (source_config){sources_array, count, rules, rule_count};
+}
+
 source_config load_sources_config() {
     size_t num_sources_to_create = 6; 
     printf("Load conf");
@@ -79,7 +352,7 @@ source_config load_sources_config() {
     virtual_source *sources_array = malloc(num_sources_to_create * sizeof(virtual_source));
     if (sources_array == NULL) {
         perror("malloc failed for sources array in conf.c");
-        return (source_config){NULL, 0}; 
+        return (source_config){NULL, 0, NULL, 0}; 
     }
 
     init_temp_sensor(&sources_array[0], 101, 2000);
@@ -90,7 +363,7 @@ source_config load_sources_config() {
     init_humidity_sensor(&sources_array[5], 501, 2500);
 
     printf("Sensore create from conf\n");
-    return (source_config){sources_array, num_sources_to_create};
+    return (source_config){sources_array, num_sources_to_create, NULL, 0};
 }
 
 void free_sources_config(source_config config) {
@@ -98,4 +371,5 @@ void free_sources_config(source_config config) {
         printf("Clean mem\n");
         free(config.sources);
     }
+    free(config.rules);
 }
\ No newline at end of file
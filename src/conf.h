@@ -2,14 +2,31 @@
 #define CONF_H
 
 #include "telemetry.h" 
+#include "alarm.h"
 #include <stddef.h>    
 
+typedef struct {
+    int source_id;
+    alarm_rule rule;
+} config_rule;
+
 typedef struct {
     virtual_source *sources;
     size_t count;          
+    config_rule *rules;
+    size_t rule_count;
 } source_config;
 
 source_config load_sources_config();
+source_config load_sources_config_file(const char *path);
 void free_sources_config(source_config config);
 
+int parse_source_type(const char *name, telemetry_data_type *type);
+const char *source_type_name(telemetry_data_type type);
+int init_source(virtual_source *s, telemetry_data_type type, int id, int interval);
+int apply_source_option(virtual_source *s, const char *key, const char *value);
+int parse_source_options(virtual_source *s, char *options);
+int parse_source_spec(char *spec, virtual_source *out);
+char *conf_next_token(char **cursor);
+
 #endif // CONF_H
\ No newline at end of file
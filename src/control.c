@@ -0,0 +1,412 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "control.h"
+#include "conf.h"
+#include "registry.h"
+#include "server_utils.h"
+#include "telemetry.h"
+#include "compress.h"
+#include "broadcast.h"
+#include "latency.h"
+#include "alarm.h"
+#include "admission.h"
+#include "pool.h"
+
+int control_reply(client_conn *conn, const char *fmt, ...) {
+    unsigned char buffer[1 + sizeof(uint16_t) + CONTROL_REPLY_SIZE];
+    char *text = (char *)buffer + 1 + sizeof(uint16_t);
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, CONTROL_REPLY_SIZE, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return -1;
+    }
+    if (len >= CONTROL_REPLY_SIZE) {
+        len = CONTROL_REPLY_SIZE - 1;
+    }
+
+    buffer[0] = 'R';
+    uint16_t net_len = htons((uint16_t)len);
+    memcpy(buffer + 1, &net_len, sizeof(net_len));
+
+    return client_queue(conn, buffer, 1 + sizeof(net_len) + (size_t)len);
+}
+
+static client_conn ***attached_conns = NULL;
+static nfds_t *attached_nfds = NULL;
+
+void control_attach_clients(client_conn ***conns, nfds_t *nfds) {
+    attached_conns = conns;
+    attached_nfds = nfds;
+}
+
+static int parse_id(char **cursor, int *id) {
+    char *word = conf_next_token(cursor);
+    if (word == NULL) {
+        return -1;
+    }
+    char *end = NULL;
+    long value = strtol(word, &end, 10);
+    if (end == word || *end != '\0' || value < 0 || value > 0x7fffffffL) {
+        return -1;
+    }
+    *id = (int)value;
+    return 0;
+}
+
+static void cmd_reload(client_conn *conn, char *args) {
+    (void)args;
+    registry_request_reload();
+    control_reply(conn, "OK reload scheduled");
+}
+
+static void cmd_add(client_conn *conn, char *args) {
+    virtual_source source;
+    if (parse_source_spec(args, &source) < 0) {
+        control_reply(conn, "ERR usage: ADD <type> <id> <interval_ms> [min= max= max_change=]");
+        return;
+    }
+    if (registry_add_source(&source) < 0) {
+        control_reply(conn, "ERR cannot add source %d", source.id);
+        return;
+    }
+    control_reply(conn, "OK added %d", source.id);
+}
+
+static void cmd_remove(client_conn *conn, char *args) {
+    int id;
+    if (parse_id(&args, &id) < 0) {
+        control_reply(conn, "ERR usage: REMOVE <id>");
+        return;
+    }
+    if (registry_remove_source(id) < 0) {
+        control_reply(conn, "ERR no source %d", id);
+        return;
+    }
+    control_reply(conn, "OK removed %d", id);
+}
+
+static void set_active(client_conn *conn, char *args, bool active) {
+    int id;
+    if (parse_id(&args, &id) < 0) {
+        control_reply(conn, "ERR usage: %s <id>", active ? "RESUME" : "PAUSE");
+        return;
+    }
+    if (registry_set_active(id, active) < 0) {
+        control_reply(conn, "ERR no source %d", id);
+        return;
+    }
+    control_reply(conn, "OK %s %d", active ? "resumed" : "paused", id);
+}
+
+static void cmd_pause(client_conn *conn, char *args) {
+    set_active(conn, args, false);
+}
+
+static void cmd_resume(client_conn *conn, char *args) {
+    set_active(conn, args, true);
+}
+
+static void cmd_set(client_conn *conn, char *args) {
+    int id;
+    if (parse_id(&args, &id) < 0) {
+        control_reply(conn, "ERR usage: SET <id> key=value...");
+        return;
+    }
+    if (registry_retune_source(id, args) < 0) {
+        control_reply(conn, "ERR cannot retune source %d", id);
+        return;
+    }
+    control_reply(conn, "OK retuned %d", id);
+}
+
+static void cmd_list(client_conn *conn, char *args) {
+    (void)args;
+    source_table *table = registry_read_lock();
+    size_t count = table != NULL ? table->count : 0;
+
+    control_reply(conn, "OK %zu sources", count);
+    for (size_t i = 0; i < count; ++i) {
+        virtual_source s;
+        pthread_mutex_lock(&sources_mutex);
+        s = table->entries[i]->source;
+        pthread_mutex_unlock(&sources_mutex);
+
+        const char *state = s.is_active ? "active" : "paused";
+        if (s.type == DATA_TYPE_GPS) {
+            control_reply(conn, "%d type=%s %s interval=%d max_change=%g",
+                          s.id, source_type_name(s.type), state, s.update_interval_ms, s.max_gps_change);
+        } else if (s.type == DATA_TYPE_STATUS) {
+            control_reply(conn, "%d type=%s %s interval=%d",
+                          s.id, source_type_name(s.type), state, s.update_interval_ms);
+        } else {
+            control_reply(conn, "%d type=%s %s interval=%d min=%g max=%g max_change=%g",
+                          s.id, source_type_name(s.type), state,
+                          s.update_interval_ms, s.min_value, s.max_value, s.max_change);
+        }
+    }
+    registry_read_unlock();
+}
+
+static void cmd_priority(client_conn *conn, char *args) {
+    char *name = conf_next_token(&args);
+    client_priority priority;
+    if (name == NULL || client_parse_priority(name, &priority) < 0) {
+        control_reply(conn, "ERR usage: PRIORITY critical|normal|bulk");
+        return;
+    }
+    conn->priority = priority;
+    control_reply(conn, "OK priority %s", client_priority_name(priority));
+}
+
+static void cmd_limit(client_conn *conn, char *args) {
+    double records = conn->record_bucket.rate;
+    double bytes = conn->byte_bucket.rate;
+    char *word;
+
+    while ((word = conf_next_token(&args)) != NULL) {
+        char *eq = strchr(word, '=');
+        char *end = NULL;
+        double value = eq != NULL ? strtod(eq + 1, &end) : -1.0;
+        if (eq == NULL || end == eq + 1 || *end != '\0' || value < 0.0) {
+            control_reply(conn, "ERR usage: LIMIT records=<per sec> bytes=<per sec> (0 - unlimited)");
+            return;
+        }
+        *eq = '\0';
+        if (strcmp(word, "records") == 0) {
+            records = value;
+        } else if (strcmp(word, "bytes") == 0) {
+            bytes = value;
+        } else {
+            control_reply(conn, "ERR unknown limit %s", word);
+            return;
+        }
+    }
+
+    long long now_ms = monotonic_ms();
+    token_bucket_set(&conn->record_bucket, records, now_ms);
+    token_bucket_set(&conn->byte_bucket, bytes, now_ms);
+    control_reply(conn, "OK limit records=%g bytes=%g", records, bytes);
+}
+
+static void cmd_compress(client_conn *conn, char *args) {
+    char *method = conf_next_token(&args);
+    char *level_str = conf_next_token(&args);
+
+    if (method != NULL && strcmp(method, "none") == 0 && level_str == NULL) {
+        compress_stream_release(conn->compressor);
+        conn->compressor = NULL;
+        conn->compress_level = 0;
+        conn->compress_in_step = false;
+        control_reply(conn, "OK compress none");
+        return;
+    }
+
+    int level = COMPRESS_DEFAULT_LEVEL;
+    if (level_str != NULL) {
+        char *end = NULL;
+        level = (int)strtol(level_str, &end, 10);
+        if (end == level_str || *end != '\0') {
+            level = -1;
+        }
+    }
+    if (method == NULL || strcmp(method, "zlib") != 0 || level < 1 || level > COMPRESS_MAX_LEVEL) {
+        control_reply(conn, "ERR usage: COMPRESS zlib [1-%d] | COMPRESS none", COMPRESS_MAX_LEVEL);
+        return;
+    }
+    compress_stream *stream = compress_stream_acquire(level);
+    if (stream == NULL) {
+        control_reply(conn, "ERR no memory for a compression stream");
+        return;
+    }
+    // 'Z' records start with the next restart frame of the level's stream.
+    compress_stream_release(conn->compressor);
+    conn->compressor = stream;
+    conn->compress_level = level;
+    conn->compress_in_step = false;
+    control_reply(conn, "OK compress zlib %d", level);
+}
+
+static void reply_latency(client_conn *conn, const char *label, const latency_summary *summary) {
+    control_reply(conn, "%s samples=%llu p50<=%lldus p99<=%lldus p99.9<=%lldus max<=%lldus", label,
+                  (unsigned long long)summary->samples,
+                  latency_percentile(summary, 50.0), latency_percentile(summary, 99.0),
+                  latency_percentile(summary, 99.9), latency_percentile(summary, 100.0));
+}
+
+static void cmd_latency(client_conn *conn, char *args) {
+    char *word = conf_next_token(&args);
+    if (word != NULL && strcmp(word, "RESET") == 0) {
+        registry_reset_latency();
+        broadcast_reset_latency();
+        admission_reset_latency();
+        control_reply(conn, "OK latency reset");
+        return;
+    }
+    if (word != NULL) {
+        control_reply(conn, "ERR usage: LATENCY [RESET]");
+        return;
+    }
+
+    latency_summary wakeups = {0};
+    latency_summary ticks = {0};
+    latency_summary accepts = {0};
+    registry_wakeup_latency(&wakeups);
+    broadcast_tick_latency(&ticks);
+    admission_latency(&accepts);
+    reply_latency(conn, "generator_wakeup", &wakeups);
+    reply_latency(conn, "tick", &ticks);
+    reply_latency(conn, "accept", &accepts);
+}
+
+static void cmd_rule(client_conn *conn, char *args) {
+    int id;
+    if (parse_id(&args, &id) < 0) {
+        control_reply(conn, "ERR usage: RULE <id> [range min= max= | rate max= | status <STATUS>"
+                            " | geofence lat= lon= radius=]");
+        return;
+    }
+
+    while (isspace((unsigned char)*args)) {
+        args++;
+    }
+    if (*args == '\0') {
+        alarm_table rules;
+        if (registry_get_rules(id, &rules) < 0) {
+            control_reply(conn, "ERR no source %d", id);
+            return;
+        }
+        control_reply(conn, "OK %d rules", rules.count);
+        for (int i = 0; i < rules.count; ++i) {
+            char text[128];
+            alarm_describe(&rules.rules[i], text, sizeof(text));
+            control_reply(conn, "%d %s %s", i, text, rules.rules[i].raised ? "raised" : "clear");
+        }
+        return;
+    }
+
+    if (registry_add_rule(id, args) < 0) {
+        control_reply(conn, "ERR cannot add rule to source %d (unknown source, bad rule or %d rules already)",
+                      id, ALARM_MAX_RULES);
+        return;
+    }
+    control_reply(conn, "OK rule added to %d", id);
+}
+
+static void cmd_unrule(client_conn *conn, char *args) {
+    int id;
+    if (parse_id(&args, &id) < 0) {
+        control_reply(conn, "ERR usage: UNRULE <id>");
+        return;
+    }
+    if (registry_clear_rules(id) < 0) {
+        control_reply(conn, "ERR no source %d", id);
+        return;
+    }
+    control_reply(conn, "OK rules cleared for %d", id);
+}
+
+static void cmd_subscribe(client_conn *conn, char *args) {
+    char *what = conf_next_token(&args);
+    unsigned subscriptions;
+
+    if (what == NULL || strcmp(what, "stream") == 0) {
+        subscriptions = CLIENT_SUB_STREAM;
+    } else if (strcmp(what, "events") == 0) {
+        subscriptions = CLIENT_SUB_EVENTS;
+    } else if (strcmp(what, "all") == 0) {
+        subscriptions = CLIENT_SUB_STREAM | CLIENT_SUB_EVENTS;
+    } else {
+        control_reply(conn, "ERR usage: SUBSCRIBE stream|events|all");
+        return;
+    }
+    conn->subscriptions = subscriptions;
+    control_reply(conn, "OK subscribed %s", what != NULL ? what : "stream");
+}
+
+static void reply_stats(client_conn *to, const client_conn *c) {
+    control_reply(to, "fd=%d prio=%s compress=%d records=%llu bytes=%llu raw_bytes=%llu"
+                      " throttled=%llu shed=%llu events=%llu events_shed=%llu queued=%zu"
+                      " limit_records=%g limit_bytes=%g",
+                  c->fd, client_priority_name(c->priority), c->compress_level,
+                  c->stats.records_sent, c->stats.bytes_sent, c->stats.bytes_raw,
+                  c->stats.records_throttled, c->stats.records_shed,
+                  c->stats.events_sent, c->stats.events_shed, c->outlen,
+                  c->record_bucket.rate, c->byte_bucket.rate);
+}
+
+static void cmd_stats(client_conn *conn, char *args) {
+    char *scope = conf_next_token(&args);
+    if (scope == NULL) {
+        reply_stats(conn, conn);
+        return;
+    }
+    if (strcmp(scope, "ALL") != 0 || attached_conns == NULL) {
+        control_reply(conn, "ERR usage: STATS [ALL]");
+        return;
+    }
+    unsigned long clients = 0;
+    for (nfds_t i = POLL_RESERVED_FDS; i < *attached_nfds; ++i) {
+        clients += (*attached_conns)[i] != NULL;
+    }
+    admission_stats admission;
+    admission_get_stats(&admission);
+    control_reply(conn, "OK %lu clients, %llu alarm events dropped", clients, alarm_dropped());
+    control_reply(conn, "accept limit=%zu accepted=%llu refused_limit=%llu refused_memory=%llu"
+                        " errors=%llu wakeups=%llu largest_batch=%zu",
+                  admission_limit(), admission.accepted, admission.refused_limit,
+                  admission.refused_memory, admission.accept_errors, admission.wakeups,
+                  admission.largest_batch);
+    control_reply(conn, "memory slabs=%zu in_use=%zu budget=%zu%s", pool_memory_used(), pool_memory_in_use(),
+                  pool_budget(), pool_under_pressure() ? " pressure" : "");
+    for (nfds_t i = POLL_RESERVED_FDS; i < *attached_nfds; ++i) {
+        if ((*attached_conns)[i] != NULL) {
+            reply_stats(conn, (*attached_conns)[i]);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*handler)(client_conn *conn, char *args);
+} commands[] = {
+    {"RELOAD", cmd_reload},
+    {"ADD", cmd_add},
+    {"REMOVE", cmd_remove},
+    {"PAUSE", cmd_pause},
+    {"RESUME", cmd_resume},
+    {"SET", cmd_set},
+    {"LIST", cmd_list},
+    {"PRIORITY", cmd_priority},
+    {"LIMIT", cmd_limit},
+    {"STATS", cmd_stats},
+    {"COMPRESS", cmd_compress},
+    {"LATENCY", cmd_latency},
+    {"RULE", cmd_rule},
+    {"UNRULE", cmd_unrule},
+    {"SUBSCRIBE", cmd_subscribe},
+};
+
+void control_handle_line(client_conn *conn, char *line) {
+    char *cursor = line;
+    char *name = conf_next_token(&cursor);
+    if (name == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i) {
+        if (strcmp(name, commands[i].name) == 0) {
+            commands[i].handler(conn, cursor);
+            return;
+        }
+    }
+    control_reply(conn, "ERR unknown command %s", name);
+}
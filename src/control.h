@@ -0,0 +1,17 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <poll.h>
+
+#include "client.h"
+
+// Text commands arrive one per line on the client connection. Replies are
+// sent back as 'R' records: tag, uint16 length, text without terminator.
+
+#define CONTROL_REPLY_SIZE 256
+
+void control_attach_clients(client_conn ***conns, nfds_t *nfds);
+void control_handle_line(client_conn *conn, char *line);
+int control_reply(client_conn *conn, const char *fmt, ...);
+
+#endif // CONTROL_H
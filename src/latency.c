@@ -0,0 +1,43 @@
+#include "latency.h"
+
+void latency_record(latency_hist *hist, long long usec) {
+    int bucket = 0;
+    while (usec > 0 && bucket < LATENCY_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&hist->buckets[bucket], 1, memory_order_relaxed);
+}
+
+void latency_reset(latency_hist *hist) {
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+void latency_add(latency_summary *summary, const latency_hist *hist) {
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        uint64_t n = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        summary->counts[i] += n;
+        summary->samples += n;
+    }
+}
+
+// Upper bound of the bucket holding the given percentile, in us.
+long long latency_percentile(const latency_summary *summary, double percentile) {
+    if (summary->samples == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)summary->samples);
+    if (rank >= summary->samples) {
+        rank = summary->samples - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += summary->counts[i];
+        if (seen > rank) {
+            return i == 0 ? 1 : 1LL << i;
+        }
+    }
+    return 1LL << (LATENCY_BUCKETS - 1);
+}
@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Log2 histogram of microsecond delays. Bucket i counts delays in
+// [2^(i-1), 2^i) us, bucket 0 counts delays below 1 us. Each histogram is
+// written by one thread; readers sum them without locking.
+
+#define LATENCY_BUCKETS 32
+
+typedef struct latency_hist {
+    atomic_ullong buckets[LATENCY_BUCKETS];
+} latency_hist;
+
+typedef struct latency_summary {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t samples;
+} latency_summary;
+
+void latency_record(latency_hist *hist, long long usec);
+void latency_reset(latency_hist *hist);
+void latency_add(latency_summary *summary, const latency_hist *hist);
+long long latency_percentile(const latency_summary *summary, double percentile);
+
+#endif // LATENCY_H
@@ -0,0 +1,270 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "affinity.h"
+
+#define POOL_DEFAULT_BUDGET (64 * 1024 * 1024)
+#define POOL_PRESSURE_PERCENT 90
+
+typedef struct free_object {
+    struct free_object *next;
+} free_object;
+
+typedef struct slab {
+    struct slab *next;
+} slab;
+
+struct mem_pool {
+    const char *name;
+    int index;
+    unsigned long serial; // tells a cache of this pool from one of an earlier pool in the slot
+    int node; // slabs are placed on this NUMA node, -1 - plain heap
+    size_t align;
+    size_t header; // slab header rounded up to align
+    size_t object_size;
+    size_t objects_per_slab;
+    pthread_mutex_t mutex;
+    free_object *free_list;
+    slab *slabs;
+};
+
+typedef struct pool_cache {
+    unsigned long serial; // pool the objects belong to, 0 - none
+    size_t count;
+    void *objects[POOL_CACHE_SIZE];
+} pool_cache;
+
+static mem_pool *pools[POOL_MAX_POOLS];
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t memory_budget = POOL_DEFAULT_BUDGET;
+static atomic_size_t memory_used = 0;   // slab bytes taken from the heap
+static atomic_size_t memory_in_use = 0; // bytes of objects handed out
+static unsigned long next_serial = 0; // under pools_mutex
+static _Thread_local pool_cache caches[POOL_MAX_POOLS];
+
+mem_pool *pool_create(const char *name, size_t object_size, size_t objects_per_slab) {
+    return pool_create_on_node(name, object_size, objects_per_slab, -1);
+}
+
+mem_pool *pool_create_on_node(const char *name, size_t object_size, size_t objects_per_slab, int node) {
+    mem_pool *pool = malloc(sizeof(*pool));
+    if (pool == NULL) {
+        perror("malloc pool");
+        return NULL;
+    }
+    if (object_size < sizeof(free_object)) {
+        object_size = sizeof(free_object);
+    }
+    // Whole cache lines get a line of their own: objects written by
+    // different threads must not share one.
+    size_t align = object_size % CACHE_LINE_SIZE == 0 ? CACHE_LINE_SIZE : sizeof(max_align_t);
+    pool->name = name;
+    pool->node = node;
+    pool->align = align;
+    pool->header = (sizeof(slab) + align - 1) / align * align;
+    pool->object_size = (object_size + align - 1) / align * align;
+    pool->objects_per_slab = objects_per_slab > 0 ? objects_per_slab : 1;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    pthread_mutex_lock(&pools_mutex);
+    pool->index = -1;
+    pool->serial = ++next_serial;
+    for (int i = 0; i < POOL_MAX_POOLS; ++i) {
+        if (pools[i] == NULL) {
+            pools[i] = pool;
+            pool->index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pools_mutex);
+
+    if (pool->index < 0) {
+        fprintf(stderr, "pool %s: too many pools (max %d)\n", name, POOL_MAX_POOLS);
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// A multiple of align, as aligned_alloc requires.
+static size_t slab_size(const mem_pool *pool) {
+    return pool->header + pool->object_size * pool->objects_per_slab;
+}
+
+// Objects still cached by other threads are forgotten, not handed out:
+// a cache only serves the pool whose serial it carries.
+void pool_destroy(mem_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    caches[pool->index].count = 0;
+    caches[pool->index].serial = 0;
+
+    pthread_mutex_lock(&pools_mutex);
+    pools[pool->index] = NULL;
+    pthread_mutex_unlock(&pools_mutex);
+
+    size_t slab_bytes = slab_size(pool);
+    slab *s = pool->slabs;
+    while (s != NULL) {
+        slab *next = s->next;
+        if (pool->node >= 0) {
+            node_free(s, slab_bytes);
+        } else {
+            free(s);
+        }
+        atomic_fetch_sub(&memory_used, slab_bytes);
+        s = next;
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+// Caller holds pool->mutex.
+static int pool_grow(mem_pool *pool) {
+    size_t slab_bytes = slab_size(pool);
+    size_t used = atomic_fetch_add(&memory_used, slab_bytes);
+    if (used + slab_bytes > atomic_load(&memory_budget)) {
+        atomic_fetch_sub(&memory_used, slab_bytes);
+        return -1;
+    }
+
+    // node_alloc hands out whole pages, so both paths keep `align`.
+    slab *s = pool->node >= 0 ? node_alloc(slab_bytes, pool->node) : aligned_alloc(pool->align, slab_bytes);
+    if (s == NULL) {
+        perror("allocate slab");
+        atomic_fetch_sub(&memory_used, slab_bytes);
+        return -1;
+    }
+    s->next = pool->slabs;
+    pool->slabs = s;
+
+    unsigned char *base = (unsigned char *)s + pool->header;
+    for (size_t i = pool->objects_per_slab; i > 0; --i) {
+        free_object *obj = (free_object *)(base + (i - 1) * pool->object_size);
+        obj->next = pool->free_list;
+        pool->free_list = obj;
+    }
+    return 0;
+}
+
+static pool_cache *cache_of(mem_pool *pool) {
+    pool_cache *cache = &caches[pool->index];
+    if (cache->serial != pool->serial) {
+        cache->serial = pool->serial;
+        cache->count = 0;
+    }
+    return cache;
+}
+
+void *pool_alloc(mem_pool *pool) {
+    pool_cache *cache = cache_of(pool);
+    if (cache->count > 0) {
+        atomic_fetch_add_explicit(&memory_in_use, pool->object_size, memory_order_relaxed);
+        return cache->objects[--cache->count];
+    }
+
+    // Refill half of the cache in one trip to the shared list.
+    pthread_mutex_lock(&pool->mutex);
+    while (cache->count < POOL_CACHE_SIZE / 2) {
+        if (pool->free_list == NULL && pool_grow(pool) < 0) {
+            break;
+        }
+        free_object *obj = pool->free_list;
+        pool->free_list = obj->next;
+        cache->objects[cache->count++] = obj;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (cache->count == 0) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&memory_in_use, pool->object_size, memory_order_relaxed);
+    return cache->objects[--cache->count];
+}
+
+void pool_free(mem_pool *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+    atomic_fetch_sub_explicit(&memory_in_use, pool->object_size, memory_order_relaxed);
+    pool_cache *cache = cache_of(pool);
+    if (cache->count == POOL_CACHE_SIZE) {
+        pthread_mutex_lock(&pool->mutex);
+        while (cache->count > POOL_CACHE_SIZE / 2) {
+            free_object *obj = cache->objects[--cache->count];
+            obj->next = pool->free_list;
+            pool->free_list = obj;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    cache->objects[cache->count++] = object;
+}
+
+// Returns the calling thread's cached objects to their pools, where other
+// threads can take them. Call before a thread exits and from threads that
+// free much more than they allocate.
+void pool_thread_flush(void) {
+    pthread_mutex_lock(&pools_mutex); // keeps pool_destroy out
+    for (int i = 0; i < POOL_MAX_POOLS; ++i) {
+        pool_cache *cache = &caches[i];
+        mem_pool *pool = pools[i];
+        if (pool == NULL || cache->serial != pool->serial) {
+            cache->count = 0;
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        while (cache->count > 0) {
+            free_object *obj = cache->objects[--cache->count];
+            obj->next = pool->free_list;
+            pool->free_list = obj;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pools_mutex);
+}
+
+// Memory allocated outside the pools (zlib streams) that still counts
+// against the budget.
+int pool_charge(size_t bytes) {
+    size_t used = atomic_fetch_add(&memory_used, bytes);
+    if (used + bytes > atomic_load(&memory_budget)) {
+        atomic_fetch_sub(&memory_used, bytes);
+        return -1;
+    }
+    atomic_fetch_add_explicit(&memory_in_use, bytes, memory_order_relaxed);
+    return 0;
+}
+
+void pool_uncharge(size_t bytes) {
+    atomic_fetch_sub(&memory_used, bytes);
+    atomic_fetch_sub_explicit(&memory_in_use, bytes, memory_order_relaxed);
+}
+
+void pool_set_budget(size_t bytes) {
+    atomic_store(&memory_budget, bytes);
+}
+
+size_t pool_budget(void) {
+    return atomic_load(&memory_budget);
+}
+
+size_t pool_memory_used(void) {
+    return atomic_load(&memory_used);
+}
+
+size_t pool_memory_in_use(void) {
+    return atomic_load_explicit(&memory_in_use, memory_order_relaxed);
+}
+
+bool pool_under_pressure(void) {
+    size_t budget = atomic_load(&memory_budget);
+    return pool_memory_in_use() >= budget / 100 * POOL_PRESSURE_PERCENT;
+}
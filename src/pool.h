@@ -0,0 +1,35 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed-size object pools carved out of slabs. Every thread keeps a small
+// cache per pool so the hot path does not touch the shared free list.
+// All pools draw from one global memory budget; pool_alloc() returns NULL
+// once it is spent and callers are expected to push back on the producer.
+// Objects whose size is a multiple of CACHE_LINE_SIZE start on a cache
+// line; the rest are aligned for any type.
+
+#define POOL_MAX_POOLS 16
+#define POOL_CACHE_SIZE 32
+#define POOL_MIN_BUDGET (1024 * 1024) // a few slabs of every pool
+
+typedef struct mem_pool mem_pool;
+
+mem_pool *pool_create(const char *name, size_t object_size, size_t objects_per_slab);
+mem_pool *pool_create_on_node(const char *name, size_t object_size, size_t objects_per_slab, int node);
+void pool_destroy(mem_pool *pool);
+void *pool_alloc(mem_pool *pool);
+void pool_free(mem_pool *pool, void *object);
+void pool_thread_flush(void);
+int pool_charge(size_t bytes);
+void pool_uncharge(size_t bytes);
+
+void pool_set_budget(size_t bytes);
+size_t pool_budget(void);
+size_t pool_memory_used(void);
+size_t pool_memory_in_use(void);
+bool pool_under_pressure(void);
+
+#endif // POOL_H
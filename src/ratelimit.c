@@ -0,0 +1,31 @@
+#include "ratelimit.h"
+
+void token_bucket_set(token_bucket *tb, double rate, long long now_ms) {
+    tb->rate = rate > 0.0 ? rate : 0.0;
+    tb->tokens = tb->rate;
+    tb->last_ms = now_ms;
+}
+
+void token_bucket_refill(token_bucket *tb, long long now_ms) {
+    if (tb->rate <= 0.0) {
+        return;
+    }
+    long long elapsed = now_ms - tb->last_ms;
+    if (elapsed > 0) {
+        tb->tokens += tb->rate * (double)elapsed / 1000.0;
+        if (tb->tokens > tb->rate) {
+            tb->tokens = tb->rate;
+        }
+    }
+    tb->last_ms = now_ms;
+}
+
+bool token_bucket_has(const token_bucket *tb, double amount) {
+    return tb->rate <= 0.0 || tb->tokens >= amount;
+}
+
+void token_bucket_consume(token_bucket *tb, double amount) {
+    if (tb->rate > 0.0) {
+        tb->tokens -= amount;
+    }
+}
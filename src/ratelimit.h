@@ -0,0 +1,19 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+
+// Token bucket refilled at `rate` tokens per second, holding at most one
+// second worth of tokens. A rate of 0 means unlimited.
+typedef struct token_bucket {
+    double rate;
+    double tokens;
+    long long last_ms;
+} token_bucket;
+
+void token_bucket_set(token_bucket *tb, double rate, long long now_ms);
+void token_bucket_refill(token_bucket *tb, long long now_ms);
+bool token_bucket_has(const token_bucket *tb, double amount);
+void token_bucket_consume(token_bucket *tb, double amount);
+
+#endif // RATELIMIT_H
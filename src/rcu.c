@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "rcu.h"
+
+typedef struct {
+    atomic_bool in_use;
+    atomic_ulong ctr; // 0 - quiescent, otherwise grace period seen at read_lock
+} rcu_reader;
+
+static atomic_ulong rcu_gp_ctr = 1;
+static rcu_reader rcu_readers[RCU_MAX_READERS];
+static _Thread_local rcu_reader *rcu_self = NULL;
+
+int rcu_register_thread(void) {
+    if (rcu_self != NULL) {
+        return 0;
+    }
+    for (int i = 0; i < RCU_MAX_READERS; ++i) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&rcu_readers[i].in_use, &expected, true)) {
+            atomic_store(&rcu_readers[i].ctr, 0);
+            rcu_self = &rcu_readers[i];
+            return 0;
+        }
+    }
+    fprintf(stderr, "rcu: too many reader threads (max %d)\n", RCU_MAX_READERS);
+    return -1;
+}
+
+void rcu_unregister_thread(void) {
+    if (rcu_self == NULL) {
+        return;
+    }
+    atomic_store(&rcu_self->ctr, 0);
+    atomic_store(&rcu_self->in_use, false);
+    rcu_self = NULL;
+}
+
+void rcu_read_lock(void) {
+    atomic_store(&rcu_self->ctr, atomic_load(&rcu_gp_ctr));
+}
+
+void rcu_read_unlock(void) {
+    atomic_store(&rcu_self->ctr, 0);
+}
+
+void rcu_synchronize(void) {
+    unsigned long gp = atomic_fetch_add(&rcu_gp_ctr, 1) + 1;
+    struct timespec pause = {0, 1000000};
+
+    for (int i = 0; i < RCU_MAX_READERS; ++i) {
+        if (!atomic_load(&rcu_readers[i].in_use)) {
+            continue;
+        }
+        for (;;) {
+            unsigned long ctr = atomic_load(&rcu_readers[i].ctr);
+            if (ctr == 0 || ctr >= gp) {
+                break;
+            }
+            nanosleep(&pause, NULL);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef RCU_H
+#define RCU_H
+
+// Minimal userspace RCU: readers never block, writers wait in
+// rcu_synchronize() until every reader that could still see an old
+// pointer has left its read-side section.
+
+#define RCU_MAX_READERS 16
+
+int rcu_register_thread(void);
+void rcu_unregister_thread(void);
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void rcu_synchronize(void);
+
+#endif // RCU_H
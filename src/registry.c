@@ -0,0 +1,712 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "registry.h"
+#include "conf.h"
+#include "rcu.h"
+#include "pool.h"
+#include "affinity.h"
+#include "snapshot.h"
+#include "columnar.h"
+
+#define ENTRY_POOL_SLAB 64
+
+pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic(source_table *) current_table = NULL;
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes table writers
+static char *config_path = NULL;
+
+// Generators are spread round-robin over these cpus; entries come from a
+// pool on the node of their cpu so the generator touches local memory.
+static cpu_list generator_cpus = {0};
+static size_t next_generator_cpu = 0;
+static mem_pool *entry_pools[AFFINITY_MAX_NODES + 1]; // [node + 1], [0] - unpinned
+
+typedef struct retire_item {
+    source_table *table;
+    source_entry **entries;
+    size_t count;
+    struct retire_item *next;
+} retire_item;
+
+// The worker reloads the config and reclaims retired tables and entries,
+// so neither the poll loop nor the generators wait for a grace period.
+static pthread_t worker_thread;
+static bool worker_started = false;
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static bool reload_pending = false;
+static bool worker_exit = false;
+static retire_item *retire_head = NULL;
+static retire_item *retire_tail = NULL;
+
+static void *source_thread_function(void *arg) {
+    source_entry *entry = (source_entry *)arg;
+    virtual_source *source = &entry->source;
+
+    struct timespec sleep_req;
+    struct timespec sleep_rem;
+    struct timespec woke;
+
+    if (entry->cpu >= 0) {
+        affinity_pin_self_to_cpu(entry->cpu);
+    }
+
+    while (!atomic_load(&entry->stop)) {
+        int ret = pthread_mutex_lock(&sources_mutex);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to lock mutex: %s\n", strerror(ret));
+            break;
+        }
+        int interval_ms = source->update_interval_ms;
+        pthread_mutex_unlock(&sources_mutex);
+
+        sleep_req.tv_sec = interval_ms / 1000;
+        sleep_req.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        long long due_us = (long long)woke.tv_sec * 1000000 + woke.tv_nsec / 1000 + (long long)interval_ms * 1000;
+
+        ret = nanosleep(&sleep_req, &sleep_rem);
+        while (ret == -1 && errno == EINTR) {
+            sleep_req = sleep_rem;
+            ret = nanosleep(&sleep_req, &sleep_rem);
+        }
+        if (ret == -1) {
+            perror("nanosleep");
+            break;
+        }
+        if (atomic_load(&entry->stop)) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        latency_record(&entry->wake_latency, (long long)woke.tv_sec * 1000000 + woke.tv_nsec / 1000 - due_us);
+
+        ret = pthread_mutex_lock(&sources_mutex);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to lock mutex: %s\n", strerror(ret));
+            break;
+        }
+
+        if (source->is_active) {
+            update_source_reading(source);
+            alarm_evaluate(&entry->alarms, &source->data);
+            snapshot_patch(entry);
+            columnar_append(&source->data);
+        }
+
+        ret = pthread_mutex_unlock(&sources_mutex);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to unlock mutex: %s\n", strerror(ret));
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Worker threads must not steal SIGINT/SIGTERM/SIGHUP from the poll loop.
+static int start_thread_blocked(pthread_t *thread, void *(*fn)(void *), void *arg) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(thread, NULL, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ret;
+}
+
+// Caller holds write_mutex.
+static mem_pool *entry_pool_for(int node) {
+    if (node < -1 || node >= AFFINITY_MAX_NODES) {
+        node = -1;
+    }
+    if (entry_pools[node + 1] == NULL) {
+        entry_pools[node + 1] = node >= 0
+            ? pool_create_on_node("source_entry", sizeof(source_entry), ENTRY_POOL_SLAB, node)
+            : pool_create("source_entry", sizeof(source_entry), ENTRY_POOL_SLAB);
+    }
+    return entry_pools[node + 1];
+}
+
+static source_entry *create_entry(const virtual_source *src) {
+    int cpu = -1;
+    if (generator_cpus.count > 0) {
+        cpu = generator_cpus.cpus[next_generator_cpu++ % (size_t)generator_cpus.count];
+    }
+    int node = cpu >= 0 ? affinity_node_of_cpu(cpu) : -1;
+
+    mem_pool *pool = entry_pool_for(node);
+    source_entry *entry = pool != NULL ? pool_alloc(pool) : NULL;
+    if (entry == NULL) {
+        fprintf(stderr, "No memory for source %d\n", src->id);
+        return NULL;
+    }
+    entry->source = *src;
+    entry->cpu = cpu;
+    entry->node = node;
+    atomic_init(&entry->stop, false);
+    latency_reset(&entry->wake_latency);
+    alarm_table_clear(&entry->alarms);
+    entry->snapshot_offset = 0;
+    entry->snapshot_generation = 0;
+
+    pthread_mutex_lock(&sources_mutex);
+    update_source_reading(&entry->source);
+    pthread_mutex_unlock(&sources_mutex);
+
+    int ret = start_thread_blocked(&entry->thread, source_thread_function, entry);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to create thread for source %d: %s\n", src->id, strerror(ret));
+        pool_free(entry_pool_for(node), entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static void destroy_entry(source_entry *entry) {
+    atomic_store(&entry->stop, true);
+    int ret = pthread_join(entry->thread, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to join thread for source %d: %s\n", entry->source.id, strerror(ret));
+    }
+    pool_free(entry_pools[entry->node + 1], entry);
+}
+
+// Takes new limits from the config but keeps the live reading of the source.
+static void retune_entry(source_entry *entry, const virtual_source *src) {
+    virtual_source *s = &entry->source;
+
+    pthread_mutex_lock(&sources_mutex);
+    s->min_value = src->min_value;
+    s->max_value = src->max_value;
+    s->max_change = src->max_change;
+    s->max_gps_change = src->max_gps_change;
+    s->update_interval_ms = src->update_interval_ms;
+    memcpy(s->statuses, src->statuses, sizeof(s->statuses));
+    s->num_statuses = src->num_statuses;
+    if (s->type != DATA_TYPE_GPS && s->type != DATA_TYPE_STATUS) {
+        if (s->current_value < s->min_value) s->current_value = s->min_value;
+        if (s->current_value > s->max_value) s->current_value = s->max_value;
+    }
+    pthread_mutex_unlock(&sources_mutex);
+}
+
+static source_table *table_alloc(size_t capacity) {
+    source_table *table = malloc(sizeof(*table));
+    if (table == NULL) {
+        perror("malloc source table");
+        return NULL;
+    }
+    table->count = 0;
+    table->entries = malloc((capacity > 0 ? capacity : 1) * sizeof(source_entry *));
+    table->by_id = malloc((capacity > 0 ? capacity : 1) * sizeof(source_entry *));
+    if (table->entries == NULL || table->by_id == NULL) {
+        perror("malloc source table entries");
+        free(table->entries);
+        free(table->by_id);
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void table_free(source_table *table) {
+    if (table != NULL) {
+        free(table->entries);
+        free(table->by_id);
+        free(table);
+    }
+}
+
+static int compare_entry_id(const void *a, const void *b) {
+    const source_entry *ea = *(source_entry *const *)a;
+    const source_entry *eb = *(source_entry *const *)b;
+    return (ea->source.id > eb->source.id) - (ea->source.id < eb->source.id);
+}
+
+static int compare_source_id(const void *a, const void *b) {
+    const virtual_source *sa = *(const virtual_source *const *)a;
+    const virtual_source *sb = *(const virtual_source *const *)b;
+    if (sa->id != sb->id) {
+        return (sa->id > sb->id) - (sa->id < sb->id);
+    }
+    return (sa > sb) - (sa < sb); // first definition in the file wins
+}
+
+static source_entry **find_slot(const source_table *table, int id) {
+    if (table == NULL || table->count == 0) {
+        return NULL;
+    }
+    source_entry key;
+    key.source.id = id;
+    source_entry *key_ptr = &key;
+    return bsearch(&key_ptr, table->by_id, table->count, sizeof(source_entry *), compare_entry_id);
+}
+
+source_entry *registry_find(const source_table *table, int id) {
+    source_entry **slot = find_slot(table, id);
+    return slot != NULL ? *slot : NULL;
+}
+
+// Hands the replaced table and the entries dropped from it to the worker,
+// which frees them after a grace period. Takes ownership of `removed`.
+static void retire(source_table *table, source_entry **removed, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        atomic_store(&removed[i]->stop, true);
+    }
+
+    retire_item *item = malloc(sizeof(*item));
+    if (item == NULL || !worker_started) {
+        if (item == NULL) {
+            perror("malloc retire item");
+        }
+        free(item);
+        rcu_synchronize();
+        for (size_t i = 0; i < count; ++i) {
+            destroy_entry(removed[i]);
+        }
+        free(removed);
+        table_free(table);
+        return;
+    }
+    item->table = table;
+    item->entries = removed;
+    item->count = count;
+    item->next = NULL;
+
+    pthread_mutex_lock(&worker_mutex);
+    if (retire_tail != NULL) {
+        retire_tail->next = item;
+    } else {
+        retire_head = item;
+    }
+    retire_tail = item;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_mutex);
+}
+
+// Caller holds write_mutex. Readers switch to `next` on their next
+// read_lock; the old table stays valid until the worker reclaims it.
+static void publish(source_table *next, source_entry **removed, size_t removed_count) {
+    memcpy(next->by_id, next->entries, next->count * sizeof(source_entry *));
+    qsort(next->by_id, next->count, sizeof(source_entry *), compare_entry_id);
+    snapshot_rebuild(next);
+
+    // Subscribers get a clear for every alarm a removed source still holds.
+    alarm_table none;
+    alarm_table_clear(&none);
+    pthread_mutex_lock(&sources_mutex);
+    for (size_t i = 0; i < removed_count; ++i) {
+        alarm_table_replace(&removed[i]->alarms, &none, removed[i]->source.id);
+    }
+    pthread_mutex_unlock(&sources_mutex);
+
+    source_table *old = atomic_exchange(&current_table, next);
+    retire(old, removed, removed_count);
+}
+
+// Rules in the config replace whatever the sources had, including rules
+// added over the control protocol. Raised alarms of rules that go away
+// are cleared for subscribers.
+static void apply_config_rules(source_table *table, source_config config) {
+    pthread_mutex_lock(&sources_mutex);
+    for (size_t i = 0; i < table->count; ++i) {
+        source_entry *entry = table->entries[i];
+        alarm_table rules;
+        alarm_table_clear(&rules);
+        for (size_t r = 0; r < config.rule_count; ++r) {
+            if (config.rules[r].source_id == entry->source.id &&
+                alarm_table_add(&rules, &config.rules[r].rule) < 0) {
+                fprintf(stderr, "Too many rules for source %d, extra rules skipped\n", entry->source.id);
+            }
+        }
+        alarm_table_replace(&entry->alarms, &rules, entry->source.id);
+    }
+    pthread_mutex_unlock(&sources_mutex);
+}
+
+// Builds the next table next to the live one: ids that survive keep their
+// entry and thread, everything else is created or retired.
+static int apply_config(source_config config) {
+    size_t added = 0, kept_count = 0;
+
+    pthread_mutex_lock(&write_mutex);
+
+    source_table *old = atomic_load(&current_table);
+    size_t old_count = old != NULL ? old->count : 0;
+
+    source_table *next = table_alloc(config.count);
+    bool *kept = calloc(old_count + 1, sizeof(bool));
+    const virtual_source **cfg_sorted = malloc((config.count + 1) * sizeof(virtual_source *));
+    bool *duplicate = calloc(config.count + 1, sizeof(bool));
+    source_entry **removed = malloc((old_count + 1) * sizeof(source_entry *));
+
+    if (next == NULL || kept == NULL || cfg_sorted == NULL || duplicate == NULL || removed == NULL) {
+        perror("malloc during source table rebuild");
+        table_free(next);
+        free(removed);
+        free(duplicate);
+        free(cfg_sorted);
+        free(kept);
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+
+    for (size_t i = 0; i < config.count; ++i) {
+        cfg_sorted[i] = &config.sources[i];
+    }
+    qsort(cfg_sorted, config.count, sizeof(virtual_source *), compare_source_id);
+    for (size_t i = 1; i < config.count; ++i) {
+        if (cfg_sorted[i]->id == cfg_sorted[i - 1]->id) {
+            duplicate[cfg_sorted[i] - config.sources] = true;
+            fprintf(stderr, "Duplicate source id %d in config, skipped\n", cfg_sorted[i]->id);
+        }
+    }
+
+    for (size_t i = 0; i < config.count; ++i) {
+        const virtual_source *src = &config.sources[i];
+        if (duplicate[i]) {
+            continue;
+        }
+
+        source_entry **slot = find_slot(old, src->id);
+        if (slot != NULL && (*slot)->source.type == src->type) {
+            source_entry *found = *slot;
+            kept[slot - old->by_id] = true;
+            retune_entry(found, src);
+            next->entries[next->count++] = found;
+            kept_count++;
+            continue;
+        }
+
+        source_entry *entry = create_entry(src);
+        if (entry == NULL) {
+            continue;
+        }
+        next->entries[next->count++] = entry;
+        added++;
+    }
+
+    size_t removed_count = 0;
+    for (size_t i = 0; i < old_count; ++i) {
+        if (!kept[i]) {
+            removed[removed_count++] = old->by_id[i];
+        }
+    }
+
+    apply_config_rules(next, config);
+    publish(next, removed, removed_count);
+    printf("Source table published: %zu sources (%zu added, %zu kept, %zu removed)\n",
+           next->count, added, kept_count, removed_count);
+
+    free(duplicate);
+    free(cfg_sorted);
+    free(kept);
+    pthread_mutex_unlock(&write_mutex);
+    return 0;
+}
+
+static void reclaim(retire_item *list) {
+    if (list == NULL) {
+        return;
+    }
+    rcu_synchronize();
+    while (list != NULL) {
+        retire_item *next = list->next;
+        for (size_t i = 0; i < list->count; ++i) {
+            destroy_entry(list->entries[i]);
+        }
+        free(list->entries);
+        table_free(list->table);
+        free(list);
+        list = next;
+    }
+    // The entries were freed into this thread's cache; generators are
+    // created elsewhere and would never see them.
+    pool_thread_flush();
+}
+
+static void reload(void) {
+    printf("Reloading sources from %s\n", config_path != NULL ? config_path : "built-in defaults");
+    source_config config = load_sources_config_file(config_path);
+    if (config.count == 0) {
+        fprintf(stderr, "Reload failed: no sources loaded, keeping current table\n");
+    } else {
+        apply_config(config);
+    }
+    free_sources_config(config);
+}
+
+static void *worker_thread_function(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&worker_mutex);
+    for (;;) {
+        while (!reload_pending && retire_head == NULL && !worker_exit) {
+            pthread_cond_wait(&worker_cond, &worker_mutex);
+        }
+        retire_item *list = retire_head;
+        retire_head = retire_tail = NULL;
+        bool do_reload = reload_pending && !worker_exit;
+        reload_pending = false;
+        bool exiting = worker_exit && list == NULL;
+        pthread_mutex_unlock(&worker_mutex);
+
+        if (exiting) {
+            pool_thread_flush();
+            return NULL;
+        }
+        reclaim(list);
+        if (do_reload) {
+            reload();
+        }
+
+        pthread_mutex_lock(&worker_mutex);
+    }
+}
+
+int registry_init(const char *path) {
+    if (path != NULL) {
+        config_path = strdup(path);
+        if (config_path == NULL) {
+            perror("strdup");
+            return -1;
+        }
+    }
+
+    int ret = start_thread_blocked(&worker_thread, worker_thread_function, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to create registry worker thread: %s\n", strerror(ret));
+    } else {
+        worker_started = true;
+    }
+
+    source_config config = load_sources_config_file(config_path);
+    if (config.count == 0) {
+        fprintf(stderr, "No sources configured\n");
+        registry_shutdown();
+        return -1;
+    }
+
+    ret = apply_config(config);
+    free_sources_config(config);
+    if (ret < 0) {
+        registry_shutdown();
+        return -1;
+    }
+    return 0;
+}
+
+void registry_shutdown(void) {
+    pthread_mutex_lock(&write_mutex);
+    source_table *table = atomic_load(&current_table);
+    if (table != NULL) {
+        source_entry **removed = malloc((table->count + 1) * sizeof(source_entry *));
+        size_t removed_count = 0;
+        if (removed != NULL) {
+            memcpy(removed, table->entries, table->count * sizeof(source_entry *));
+            removed_count = table->count;
+        }
+        atomic_store(&current_table, NULL);
+        snapshot_rebuild(NULL);
+        retire(table, removed, removed_count);
+    }
+    pthread_mutex_unlock(&write_mutex);
+
+    if (worker_started) {
+        pthread_mutex_lock(&worker_mutex);
+        worker_exit = true;
+        pthread_cond_signal(&worker_cond);
+        pthread_mutex_unlock(&worker_mutex);
+        pthread_join(worker_thread, NULL);
+        worker_started = false;
+    }
+
+    for (size_t i = 0; i < sizeof(entry_pools) / sizeof(entry_pools[0]); ++i) {
+        pool_destroy(entry_pools[i]);
+        entry_pools[i] = NULL;
+    }
+
+    free(config_path);
+    config_path = NULL;
+}
+
+void registry_set_generator_cpus(const cpu_list *cpus) {
+    generator_cpus = *cpus;
+}
+
+void registry_wakeup_latency(latency_summary *summary) {
+    source_table *table = registry_read_lock();
+    size_t count = table != NULL ? table->count : 0;
+    for (size_t i = 0; i < count; ++i) {
+        latency_add(summary, &table->entries[i]->wake_latency);
+    }
+    registry_read_unlock();
+}
+
+void registry_reset_latency(void) {
+    source_table *table = registry_read_lock();
+    size_t count = table != NULL ? table->count : 0;
+    for (size_t i = 0; i < count; ++i) {
+        latency_reset(&table->entries[i]->wake_latency);
+    }
+    registry_read_unlock();
+}
+
+int registry_add_source(const virtual_source *src) {
+    pthread_mutex_lock(&write_mutex);
+
+    source_table *old = atomic_load(&current_table);
+    if (registry_find(old, src->id) != NULL) {
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+
+    size_t old_count = old != NULL ? old->count : 0;
+    source_table *next = table_alloc(old_count + 1);
+    if (next == NULL) {
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+    source_entry *entry = create_entry(src);
+    if (entry == NULL) {
+        table_free(next);
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+
+    if (old_count > 0) {
+        memcpy(next->entries, old->entries, old_count * sizeof(source_entry *));
+    }
+    next->entries[old_count] = entry;
+    next->count = old_count + 1;
+
+    publish(next, NULL, 0);
+    pthread_mutex_unlock(&write_mutex);
+    return 0;
+}
+
+int registry_remove_source(int id) {
+    pthread_mutex_lock(&write_mutex);
+
+    source_table *old = atomic_load(&current_table);
+    source_entry *entry = registry_find(old, id);
+    source_entry **removed = malloc(sizeof(source_entry *));
+    source_table *next = entry != NULL ? table_alloc(old->count - 1) : NULL;
+    if (next == NULL || removed == NULL) {
+        free(removed);
+        table_free(next);
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+
+    for (size_t i = 0; i < old->count; ++i) {
+        if (old->entries[i] != entry) {
+            next->entries[next->count++] = old->entries[i];
+        }
+    }
+    removed[0] = entry;
+
+    publish(next, removed, 1);
+    pthread_mutex_unlock(&write_mutex);
+    return 0;
+}
+
+int registry_set_active(int id, bool active) {
+    pthread_mutex_lock(&write_mutex);
+    source_table *table = atomic_load(&current_table);
+    source_entry *entry = registry_find(table, id);
+    if (entry != NULL) {
+        pthread_mutex_lock(&sources_mutex);
+        entry->source.is_active = active;
+        pthread_mutex_unlock(&sources_mutex);
+        snapshot_rebuild(table); // paused sources are left out, as in the tick
+    }
+    pthread_mutex_unlock(&write_mutex);
+    return entry != NULL ? 0 : -1;
+}
+
+int registry_retune_source(int id, char *options) {
+    source_table *table = registry_read_lock();
+    source_entry *entry = registry_find(table, id);
+    int result = -1;
+
+    if (entry != NULL) {
+        virtual_source tuned;
+        pthread_mutex_lock(&sources_mutex);
+        tuned = entry->source;
+        pthread_mutex_unlock(&sources_mutex);
+
+        if (parse_source_options(&tuned, options) == 0) {
+            retune_entry(entry, &tuned);
+            result = 0;
+        }
+    }
+    registry_read_unlock();
+    return result;
+}
+
+int registry_add_rule(int id, char *spec) {
+    source_table *table = registry_read_lock();
+    source_entry *entry = registry_find(table, id);
+    int result = -1;
+
+    if (entry != NULL) {
+        alarm_rule rule;
+        // The type of a source never changes, only its limits do.
+        if (alarm_compile(spec, entry->source.type, &rule) == 0) {
+            pthread_mutex_lock(&sources_mutex);
+            result = alarm_table_add(&entry->alarms, &rule);
+            pthread_mutex_unlock(&sources_mutex);
+        }
+    }
+    registry_read_unlock();
+    return result;
+}
+
+int registry_clear_rules(int id) {
+    source_table *table = registry_read_lock();
+    source_entry *entry = registry_find(table, id);
+    if (entry != NULL) {
+        alarm_table none;
+        alarm_table_clear(&none);
+        pthread_mutex_lock(&sources_mutex);
+        alarm_table_replace(&entry->alarms, &none, entry->source.id);
+        pthread_mutex_unlock(&sources_mutex);
+    }
+    registry_read_unlock();
+    return entry != NULL ? 0 : -1;
+}
+
+int registry_get_rules(int id, alarm_table *out) {
+    source_table *table = registry_read_lock();
+    source_entry *entry = registry_find(table, id);
+    if (entry != NULL) {
+        pthread_mutex_lock(&sources_mutex);
+        *out = entry->alarms;
+        pthread_mutex_unlock(&sources_mutex);
+    }
+    registry_read_unlock();
+    return entry != NULL ? 0 : -1;
+}
+
+source_table *registry_read_lock(void) {
+    rcu_read_lock();
+    return atomic_load(&current_table);
+}
+
+void registry_read_unlock(void) {
+    rcu_read_unlock();
+}
+
+void registry_request_reload(void) {
+    pthread_mutex_lock(&worker_mutex);
+    reload_pending = true;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_mutex);
+}
@@ -0,0 +1,58 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "telemetry.h"
+#include "affinity.h"
+#include "latency.h"
+#include "alarm.h"
+
+// Cache-line aligned and padded: every generator writes its own entry on
+// each wakeup, and entries share slabs.
+typedef struct source_entry {
+    _Alignas(CACHE_LINE_SIZE) virtual_source source;
+    pthread_t thread;
+    atomic_bool stop;
+    int cpu;  // generator pinned here, -1 - unpinned
+    int node;
+    latency_hist wake_latency; // oversleep of the generator, us
+    alarm_table alarms;        // under sources_mutex
+    size_t snapshot_offset;    // slot in the join snapshot, under sources_mutex
+    unsigned long snapshot_generation;
+} source_entry;
+
+// Immutable once published; replaced as a whole and reclaimed through RCU.
+typedef struct source_table {
+    source_entry **entries; // broadcast order
+    source_entry **by_id;   // sorted by source id
+    size_t count;
+} source_table;
+
+extern pthread_mutex_t sources_mutex;
+
+void registry_set_generator_cpus(const cpu_list *cpus);
+int registry_init(const char *config_path);
+void registry_shutdown(void);
+
+source_table *registry_read_lock(void);
+void registry_read_unlock(void);
+
+source_entry *registry_find(const source_table *table, int id);
+
+void registry_request_reload(void);
+int registry_add_source(const virtual_source *src);
+int registry_remove_source(int id);
+int registry_set_active(int id, bool active);
+int registry_retune_source(int id, char *options);
+
+int registry_add_rule(int id, char *spec);
+int registry_clear_rules(int id);
+int registry_get_rules(int id, alarm_table *out);
+
+void registry_wakeup_latency(latency_summary *summary);
+void registry_reset_latency(void);
+
+#endif // REGISTRY_H
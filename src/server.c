@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -13,26 +14,37 @@
 #include <signal.h>
 
 #include "telemetry.h"
-#include "conf.h"
+#include "registry.h"
+#include "rcu.h"
+#include "client.h"
+#include "control.h"
+#include "broadcast.h"
+#include "pool.h"
+#include "simulate.h"
+#include "affinity.h"
 #include "server_utils.h"
+#include "alarm.h"
+#include "admission.h"
+#include "columnar.h"
 
 #define INIT_FDS_CAPACITY 10
-#define BUFFER_SIZE 64
 
-pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
 volatile bool server_running = true;
+volatile sig_atomic_t reload_requested = 0;
 
 
-void* source_thread_function(void *arg);
 void signal_handler(int signum);
-void initialize_source(virtual_source *sources, size_t num_sources);
 
-int main() {
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c sources.conf] [-B tick_budget_bytes] [-M memory_budget_bytes]\n"
+                    "       [-p port] [-b backlog] [-C max_clients] [-X columnar_export_dir]\n"
+                    "       [-I io_cpus] [-G generator_cpus]   (cpu lists like 0-3,8)\n"
+                    "       %s -S seconds [-c sources.conf] [-o out.bin] [-s seed] [-j threads] [-T start_ms]\n"
+                    "          [-X columnar_export_dir]   (-j is capped at the number of sources)\n",
+            prog, prog);
+}
 
-    struct timespec last_send_time = {0};
-    struct timespec current_time = {0};
-    last_send_time.tv_sec = 1;
-    current_time.tv_sec = 0;
+int main(int argc, char *argv[]) {
 
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -48,90 +60,243 @@ int main() {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
 
-    virtual_source *sources = NULL;
-    size_t source_count = 0;
-    
-    pthread_t *source_threads = NULL;
- 
-    int listen_fd = -1, connect_fd = -1;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+    const char *config_path = NULL;
+    bool simulate = false;
+    sim_options sim = {
+        .output_path = SIM_DEFAULT_OUTPUT,
+        .start_ms = SIM_DEFAULT_START_MS,
+        .seed = 1,
+        .threads = (int)sysconf(_SC_NPROCESSORS_ONLN),
+    };
+    int opt;
+    static cpu_list io_cpus, generator_cpus;
+    int port = DEFAULT_PORT;
+    int backlog = DEFAULT_BACKLOG;
+    const char *export_dir = NULL;
+    unsigned long long number;
+    while ((opt = getopt(argc, argv, "c:B:M:S:o:s:j:T:I:G:p:b:C:X:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                if (port <= 0 || port > 65535) {
+                    fprintf(stderr, "Invalid port: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                backlog = atoi(optarg);
+                if (backlog <= 0) {
+                    fprintf(stderr, "Invalid backlog: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'C':
+                if (parse_unsigned(optarg, 1, SIZE_MAX, &number) < 0) {
+                    fprintf(stderr, "Invalid client limit: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                admission_set_limit((size_t)number);
+                break;
+            case 'X':
+                export_dir = optarg;
+                break;
+            case 'B':
+                if (parse_unsigned(optarg, BROADCAST_MIN_BUDGET, SIZE_MAX, &number) < 0) {
+                    fprintf(stderr, "Invalid tick budget: %s (at least %d bytes)\n", optarg, BROADCAST_MIN_BUDGET);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                broadcast_set_budget((size_t)number);
+                break;
+            case 'M':
+                if (parse_unsigned(optarg, POOL_MIN_BUDGET, SIZE_MAX, &number) < 0) {
+                    fprintf(stderr, "Invalid memory budget: %s (at least %d bytes)\n", optarg, POOL_MIN_BUDGET);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                pool_set_budget((size_t)number);
+                break;
+            case 'S': {
+                char *end = NULL;
+                double seconds = strtod(optarg, &end);
+                // The negated test also rejects NaN.
+                if (end == optarg || *end != '\0' || !(seconds >= 0.001 && seconds <= SIM_MAX_SECONDS)) {
+                    fprintf(stderr, "Invalid simulated duration: %s (0.001-%g seconds)\n", optarg, SIM_MAX_SECONDS);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                simulate = true;
+                sim.duration_ms = (long long)(seconds * 1000.0);
+                break;
+            }
+            case 'o':
+                sim.output_path = optarg;
+                break;
+            case 's':
+                if (parse_unsigned(optarg, 0, UINT64_MAX, &number) < 0) {
+                    fprintf(stderr, "Invalid seed: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                sim.seed = number;
+                break;
+            case 'j':
+                if (parse_unsigned(optarg, 1, SIM_MAX_THREADS, &number) < 0) {
+                    fprintf(stderr, "Invalid thread count: %s (1-%d)\n", optarg, SIM_MAX_THREADS);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                sim.threads = (int)number;
+                break;
+            case 'T':
+                if (parse_unsigned(optarg, 0, SIM_MAX_START_MS, &number) < 0) {
+                    fprintf(stderr, "Invalid start time: %s (ms since the epoch)\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                sim.start_ms = (long long)number;
+                break;
+            case 'I':
+            case 'G':
+                if (affinity_parse_cpulist(optarg, opt == 'I' ? &io_cpus : &generator_cpus) < 0) {
+                    fprintf(stderr, "Invalid cpu list: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
 
-    srand(time(NULL));
-    source_config config = load_sources_config();
-    
-    if (config.count == 0) {
-        fprintf(stderr, "No sources configured\n");
+    affinity_init();
+    affinity_report(&io_cpus, &generator_cpus);
+    registry_set_generator_cpus(&generator_cpus);
+
+    // The simulation has no deadline to keep, so its export is lossless.
+    if (export_dir != NULL && columnar_open(export_dir, simulate) < 0) {
         return EXIT_FAILURE;
     }
 
-    source_count = config.count;
-    sources = config.sources;
-    initialize_source(sources, source_count);
+    if (simulate) {
+        sim.config_path = config_path;
+        sim.cpus = &generator_cpus;
+        int sim_result = simulate_run(&sim);
+        columnar_close();
+        if (columnar_rows_dropped() > 0) {
+            fprintf(stderr, "Columnar export dropped %llu rows\n", columnar_rows_dropped());
+            sim_result = -1;
+        }
+        return sim_result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int listen_fd = -1;
+    struct sockaddr_in server_addr;
+
+    // Only the server has an I/O thread; the simulation is not pinned.
+    if (io_cpus.count > 0 && affinity_pin_self(&io_cpus) < 0) {
+        columnar_close();
+        return EXIT_FAILURE;
+    }
+    int io_node = io_cpus.count > 0 ? affinity_node_of_cpu(io_cpus.cpus[0]) : -1;
+
+    srand(time(NULL));
+    rcu_register_thread();
+    if (client_pools_init(io_node) < 0) {
+        columnar_close();
+        return EXIT_FAILURE;
+    }
+    int alarm_fd = alarm_init();
+    if (alarm_fd < 0) {
+        client_pools_destroy();
+        columnar_close();
+        return EXIT_FAILURE;
+    }
+    if (registry_init(config_path) < 0) {
+        alarm_shutdown();
+        client_pools_destroy();
+        columnar_close();
+        return EXIT_FAILURE;
+    }
 
     listen_fd = socket_create();
-    set_address(&server_addr);
+    set_address(&server_addr, port);
     bind_socket(listen_fd, &server_addr);
-    listen_socket(listen_fd);
+    listen_socket(listen_fd, backlog);
+    // Drained until EAGAIN on each wakeup, so it must not block.
+    if (set_nonblocking(listen_fd) < 0) {
+        close(listen_fd);
+        registry_shutdown();
+        columnar_close();
+        alarm_shutdown();
+        client_pools_destroy();
+        return EXIT_FAILURE;
+    }
 
-    printf("Listening on port %d with backlog size %d\n", PORT, BACKLOG_SIZE);
+    printf("Listening on port %d with backlog size %d, client limit %zu\n", port, backlog, admission_limit());
 
     struct pollfd *fds = NULL;
+    client_conn **conns = NULL;
     nfds_t nfds = 0;
     size_t fds_capacity = INIT_FDS_CAPACITY;
 
     fds = malloc(fds_capacity * sizeof(struct pollfd));
+    conns = malloc(fds_capacity * sizeof(client_conn *));
+    if (fds == NULL || conns == NULL) {
+        perror("malloc");
+        free(fds);
+        free(conns);
+        close(listen_fd);
+        registry_shutdown();
+        columnar_close();
+        alarm_shutdown();
+        client_pools_destroy();
+        exit(EXIT_FAILURE);
+    }
     for (size_t i = 0; i < fds_capacity; ++i) {
         fds[i].fd = -1;
         fds[i].events = 0;
         fds[i].revents = 0;
+        conns[i] = NULL;
     }
     printf("Allocated memory for fds\n");
-    if (fds == NULL) {
-        perror("malloc");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
-    }
 
     fds[0].fd = listen_fd;
     fds[0].events = POLLIN;
-    nfds = 1;
+    // Generators write to this pipe when an alarm rule changes state.
+    fds[1].fd = alarm_fd;
+    fds[1].events = POLLIN;
+    nfds = POLL_RESERVED_FDS;
 
-    source_threads = malloc(source_count * sizeof(pthread_t));
-    if (source_threads == NULL) {
-        perror("malloc");
-        free(fds);
-        free_sources_config(config);
-        if (listen_fd >= 0) {
-            close(listen_fd);
-        }
-        pthread_mutex_destroy(&sources_mutex);
-        exit(EXIT_FAILURE);
-    }
-
-    for (size_t i = 0; i < source_count; ++i) {
-        int ret = pthread_create(&source_threads[i], NULL, source_thread_function, (void *)&sources[i]);
-        if (ret != 0) {
-            server_running = false;
-            for (size_t j = 0; j < i; ++j) {
-                pthread_join(source_threads[j], NULL);
-            }
-            fprintf(stderr, "Failed to create thread for source %d: %s\n", sources[i].id, strerror(ret));
-            free(source_threads);
-            free(fds);
-            free_sources_config(config);
-            if (listen_fd >= 0) {
-                close(listen_fd);
-            }
-            pthread_mutex_destroy(&sources_mutex);
-            exit(EXIT_FAILURE);
-        }
-    }
+    control_attach_clients(&conns, &nfds);
+    long long next_tick_ms = monotonic_ms();
+    bool accept_paused = false;
 
     while(server_running) {
 
-        int poll_count = poll(fds, nfds, -1);
+        long long now_ms = monotonic_ms();
+        long long wake_ms = next_tick_ms;
+        long long resume_ms = admission_resume_ms();
+        if (resume_ms > 0 && resume_ms < wake_ms) {
+            wake_ms = resume_ms; // a paused listener has nothing else to wake us
+        }
+        int timeout_ms = wake_ms > now_ms ? (int)(wake_ms - now_ms) : 0;
+        int poll_count = poll(fds, nfds, timeout_ms);
+        long long woke_us = monotonic_us();
+
+        if (reload_requested) {
+            reload_requested = 0;
+            registry_request_reload();
+        }
 
         if (poll_count < 0) {
             if (errno == EINTR && server_running) {
@@ -142,7 +307,7 @@ int main() {
             break;
         }
 
-        for (nfds_t i = 0; i < nfds; i++) {
+        for (nfds_t i = 0; i < nfds && poll_count > 0; i++) {
 
             if (fds[i].revents == 0) {
                 continue;
@@ -151,194 +316,113 @@ int main() {
             if (fds[i].fd == listen_fd) {
                 
                 if (fds[i].revents & POLLIN) {
-
-                    client_addr_len = sizeof(client_addr);
-                    connect_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-
-                    if (connect_fd < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            perror("accept error");
-                            break;
-                        }
-                    }
-
-                    if (nfds >= fds_capacity) {
-                        if (fds_realloc(&fds, &fds_capacity) < 0) {
-                            fprintf(stderr, "Ошибка realloc fds, не можем добавить клиента fd=%d\n", connect_fd);
-                            close(connect_fd);
-                            continue;
-                        }
-                    }
-                    
-
-                    fds[nfds].fd = connect_fd;
-                    fds[nfds].events = POLLOUT | POLLIN; 
-                    nfds++;
-                    printf("Клиент fd=%d добавлен. Всего дескрипторов: %lu\n", connect_fd, nfds);
-
+                    admission_accept(listen_fd, &fds, &conns, &nfds, &fds_capacity, woke_us);
                 } else if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
                     fprintf(stderr, "Критическая ошибка на слушающем сокете (fd=%d)! Завершение...\n", listen_fd);
                     server_running = false;
                 }
+            } else if (fds[i].fd == alarm_fd) {
+                alarm_clear_wakeup();
+                broadcast_events(conns, nfds);
             } else {
                 int client_fd = fds[i].fd;
 
                 if (fds[i].revents & POLLIN) {
 
-                    char dummy_buffer;
-                    printf("Client recv fds %d\n", fds[i].fd);
-                    ssize_t bytes_received = recv(client_fd, &dummy_buffer, 1, 0);
+                    ssize_t bytes_received = client_read_commands(conns[i]);
                     if (bytes_received == 0) {
-                        client_error(&nfds, &i, &fds);
+                        client_error(&nfds, &i, &fds, conns);
                         printf("Клиент fd=%d отключился. Всего дескрипторов: %lu\n", client_fd, nfds);
+                        continue;
                     } else if (bytes_received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
                         perror("recv error on client socket");
-                        client_error(&nfds, &i, &fds);
-                    } else {
-                        printf("Received data %zu bytes from client fd %d\n", bytes_received, client_fd);
-                        fds[i].revents = POLLOUT;
+                        client_error(&nfds, &i, &fds, conns);
+                        continue;
                     }
+                }
 
-                } else if (fds[i].revents & POLLOUT) {
-                    continue;
+                if (fds[i].revents & (POLLIN | POLLOUT)) {
+                    if (client_flush(conns[i]) < 0) {
+                        client_error(&nfds, &i, &fds, conns);
+                        printf("Клиент fd=%d отключился. Всего дескрипторов: %lu\n", client_fd, nfds);
+                    }
                 } else {
-                    client_error(&nfds, &i, &fds);
+                    client_error(&nfds, &i, &fds, conns);
                     printf("Клиент fd=%d отключился. Всего дескрипторов: %lu\n", client_fd, nfds);
                 }
             }
         }
-        if (last_send_time.tv_sec - current_time.tv_sec >= 1) {
-            clock_gettime(CLOCK_MONOTONIC, &current_time);
-
-            unsigned char send_buffer[BUFFER_SIZE]; 
-
-            for (nfds_t j = 1; j < nfds; ++j) {
 
-                int client_fd = fds[j].fd;  
-                if (client_fd < 0) continue;
-
-                printf("FFF DATA fd %d (индекс j=%lu)...\n", client_fd, j);
-
-                for (size_t k = 0; k < source_count; ++k) {
-                    telemetry_data data;
-                    bool is_active = false;
-
-                    int ret = pthread_mutex_lock(&sources_mutex);
-                    if (ret != 0) { fprintf(stderr, "ОШИБКА: lock mutex: %s\n", strerror(ret)); continue; }
-
-                    if (sources[k].is_active) {
-                        data = sources[k].data;
-                        is_active = true;
-                    }
-
-                    ret = pthread_mutex_unlock(&sources_mutex);
-                    if (ret != 0) { fprintf(stderr, "ОШИБКА: unlock mutex: %s\n", strerror(ret)); continue; }
-
-                    if (!is_active) continue;
-
-                    ssize_t bytes_to_send = serialize_telemetry_data(&data, send_buffer, sizeof(send_buffer));
-                    if (bytes_to_send <= 0) {
-                        continue;
-                    }
-
-                    ssize_t bytes_sent = send_all(client_fd, send_buffer, (size_t)bytes_to_send);
-                    if (bytes_sent < 0 || (size_t)bytes_sent < (size_t)bytes_to_send) {
-                        client_error(&nfds, &j, &fds);
-                        break;
-                    }
+        now_ms = monotonic_ms();
+        if (now_ms >= next_tick_ms) {
+            broadcast_record_lateness(now_ms - next_tick_ms);
+            next_tick_ms = now_ms + TICK_INTERVAL_MS;
+            broadcast_tick(conns, nfds);
 
+            for (nfds_t j = POLL_RESERVED_FDS; j < nfds; ++j) {
+                if (conns[j] != NULL && client_flush(conns[j]) < 0) {
+                    client_error(&nfds, &j, &fds, conns);
                 }
             }
         }
-        clock_gettime(CLOCK_MONOTONIC, &last_send_time);
-    }
 
-    printf("Exiting...\n");
+        for (nfds_t j = POLL_RESERVED_FDS; j < nfds; ++j) {
+            if (conns[j] != NULL) {
+                fds[j].events = POLLIN | (client_has_pending(conns[j]) ? POLLOUT : 0);
+            }
+        }
 
-    if (source_threads != NULL) {
-        for (size_t i = 0; i < source_count; ++i) {
-            int ret = pthread_join(source_threads[i], NULL);
-            if (ret != 0) {
-                fprintf(stderr, "Failed to join thread for source %d: %s\n", sources[i].id, strerror(ret));
+        // Out of memory budget: leave new peers in the kernel backlog
+        // until queued output drains. Same while out of descriptors.
+        bool memory_pressure = pool_under_pressure();
+        bool fd_backoff = admission_backoff(monotonic_ms());
+        bool pressure = memory_pressure || fd_backoff;
+        if (pressure != accept_paused) {
+            accept_paused = pressure;
+            fds[0].events = accept_paused ? 0 : POLLIN;
+            if (!accept_paused) {
+                printf("Resume accepting: pool memory in use %zu of %zu bytes\n",
+                       pool_memory_in_use(), pool_budget());
+            } else if (memory_pressure) {
+                printf("Pause accepting: pool memory in use %zu of %zu bytes\n",
+                       pool_memory_in_use(), pool_budget());
+            } else {
+                printf("Pause accepting for %d ms: out of descriptors or socket buffers\n",
+                       ACCEPT_BACKOFF_MS);
             }
         }
-        free(source_threads);
-        source_threads = NULL;
     }
 
-    for (nfds_t i = 1; i < nfds; i++) {
-        close(fds[i].fd);
+    printf("Exiting...\n");
+
+    for (nfds_t i = POLL_RESERVED_FDS; i < nfds; i++) {
+        if (conns[i] != NULL) {
+            close(fds[i].fd);
+            client_conn_destroy(conns[i]);
+        }
     }
     free(fds);
+    free(conns);
     
     if (listen_fd >= 0) {
         close(listen_fd);
     }
 
-    free_sources_config(config);
+    broadcast_cleanup();
+    registry_shutdown();
+    columnar_close(); // after the generators are joined
+    alarm_shutdown();
+    client_pools_destroy();
+    rcu_unregister_thread();
     pthread_mutex_destroy(&sources_mutex);
 
     return 0;
 }
 
-void* source_thread_function(void *arg) {
-    if (arg == NULL) {
-        fprintf(stderr, "NULL argument passed to source thread function\n");
-        pthread_exit((void *)-1);
-    }
-
-    virtual_source *source = (virtual_source *)arg;
-
-    struct timespec sleep_req;
-    struct timespec sleep_rem;
-    sleep_req.tv_sec = source->update_interval_ms / 1000;
-    sleep_req.tv_nsec = (source->update_interval_ms % 1000) * 1000000;
-
-    while (server_running) {
-        int ret = nanosleep(&sleep_req, &sleep_rem);
-        while (ret == -1 && errno == EINTR) {
-            sleep_req = sleep_rem;
-            ret = nanosleep(&sleep_req, &sleep_rem);
-        }
-        if (ret == -1 && errno != EINTR) {
-            perror("nanosleep");
-            break;
-        }
-        if (!server_running) {
-            break;
-        }
-        
-        ret = pthread_mutex_lock(&sources_mutex);
-
-        if (ret != 0) {
-            fprintf(stderr, "Failed to lock mutex: %s\n", strerror(ret));
-            break;
-        }
-
-        if (source->is_active) {
-            update_source_reading(source);
-        } 
-
-        ret = pthread_mutex_unlock(&sources_mutex);
-
-        if (ret != 0) {
-            fprintf(stderr, "Failed to unlock mutex: %s\n", strerror(ret));
-            break;
-        }
-    }
-
-    pthread_exit(NULL);
-}
-
 void signal_handler(int signum) {
-    server_running = false;
-}
-
-void initialize_source(virtual_source *sources, size_t num_sources) {
-    pthread_mutex_lock(&sources_mutex);
-    for (size_t i = 0; i < num_sources; ++i) {
-        update_source_reading(&sources[i]);
+    if (signum == SIGHUP) {
+        reload_requested = 1;
+        return;
     }
-    pthread_mutex_unlock(&sources_mutex);
-    printf("Inititial sensor\n");
+    server_running = false;
 }
\ No newline at end of file
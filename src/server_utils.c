@@ -2,10 +2,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <poll.h>    
 #include <errno.h>  
+#include <time.h>
 
 #include "server_utils.h"
 
@@ -28,11 +30,11 @@ int socket_create() {
     return listen_fd;
 }
 
-void set_address(struct sockaddr_in *addr) {
+void set_address(struct sockaddr_in *addr, int port) {
     memset(addr, 0, sizeof(*addr));
     addr->sin_family = AF_INET;
     addr->sin_addr.s_addr = INADDR_ANY;
-    addr->sin_port = htons(PORT);
+    addr->sin_port = htons((uint16_t)port);
 }
 
 void bind_socket(int listen_fd, struct sockaddr_in *addr) {
@@ -43,34 +45,59 @@ void bind_socket(int listen_fd, struct sockaddr_in *addr) {
     }
 }
 
-void listen_socket(int listen_fd) {
-    if (listen(listen_fd, BACKLOG_SIZE) < 0) {
+void listen_socket(int listen_fd, int backlog) {
+    if (listen(listen_fd, backlog) < 0) {
         perror("listen");
         close(listen_fd);
         exit(EXIT_FAILURE);
     }
 } 
- 
-int fds_realloc(struct pollfd **fds_ptr, size_t *fds_capacity_ptr) {
-    int old_capacity = *fds_capacity_ptr;
-    int new_capacity = old_capacity * 2;
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl O_NONBLOCK");
+        return -1;
+    }
+    return 0;
+}
+
+int fds_realloc(struct pollfd **fds_ptr, client_conn ***conns_ptr, size_t *fds_capacity_ptr) {
+    size_t old_capacity = *fds_capacity_ptr;
+    size_t new_capacity = old_capacity * 2;
 
     struct pollfd *temp_fds = realloc(*fds_ptr, sizeof(struct pollfd) * new_capacity);
 
     if (temp_fds == NULL) {
         perror("realloc");
         return -1;
-    } else {
-        *fds_ptr = temp_fds;
-        *fds_capacity_ptr = new_capacity;
-        return 0;
     }
+    *fds_ptr = temp_fds;
+
+    client_conn **temp_conns = realloc(*conns_ptr, sizeof(client_conn *) * new_capacity);
+    if (temp_conns == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    *conns_ptr = temp_conns;
+
+    for (size_t i = old_capacity; i < new_capacity; ++i) {
+        temp_fds[i].fd = -1;
+        temp_fds[i].events = 0;
+        temp_fds[i].revents = 0;
+        temp_conns[i] = NULL;
+    }
+    *fds_capacity_ptr = new_capacity;
+    return 0;
 }
 
-void client_error(nfds_t *nfds, nfds_t *i, struct pollfd **fds) {
+void client_error(nfds_t *nfds, nfds_t *i, struct pollfd **fds, client_conn **conns) {
 
     close((*fds)[*i].fd);
-    
+    client_conn_destroy(conns[*i]);
+
+    conns[*i] = conns[*nfds - 1];
+    conns[*nfds - 1] = NULL;
     (*fds)[*i] = (*fds)[*nfds - 1];
     (*fds)[*nfds - 1].fd = -1;
     (*fds)[*nfds - 1].events = 0;
@@ -79,6 +106,33 @@ void client_error(nfds_t *nfds, nfds_t *i, struct pollfd **fds) {
     (*i)--;
 }
 
+long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Whole decimal number in [min, max]: no sign, no blanks, nothing after it.
+int parse_unsigned(const char *str, unsigned long long min, unsigned long long max, unsigned long long *out) {
+    if (str[0] < '0' || str[0] > '9') {
+        return -1;
+    }
+    char *end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno != 0 || *end != '\0' || value < min || value > max) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 ssize_t send_all(int sockfd, const unsigned char *buf, size_t len) {
     size_t total_sent = 0;
     ssize_t bytes_sent;
@@ -88,7 +142,7 @@ ssize_t send_all(int sockfd, const unsigned char *buf, size_t len) {
     }
 
     while (total_sent < len) {
-        bytes_sent = send(sockfd, buf + total_sent, len - total_sent, 0);
+        bytes_sent = send(sockfd, buf + total_sent, len - total_sent, MSG_NOSIGNAL);
         if (bytes_sent == -1) {
             if (errno == EINTR) {
                 perror("send EINTR");
@@ -7,15 +7,21 @@
 #include <poll.h>
 
 #include "telemetry.h"
+#include "client.h"
 
-#define PORT 8080
-#define BACKLOG_SIZE 10
+#define DEFAULT_PORT 8080
+#define DEFAULT_BACKLOG 512 // clamped by net.core.somaxconn
+#define POLL_RESERVED_FDS 2 // listener and alarm wakeup pipe, clients follow
 
 int socket_create();
-void set_address(struct sockaddr_in *addr);
+void set_address(struct sockaddr_in *addr, int port);
 void bind_socket(int listen_fd, struct sockaddr_in *addr);
-void listen_socket(int listen_fd);
-void client_error(nfds_t *nfds, nfds_t *i, struct pollfd **fds);
-int fds_realloc(struct pollfd **fds_ptr, size_t *fds_capacity_ptr);
+void listen_socket(int listen_fd, int backlog);
+int set_nonblocking(int fd);
+void client_error(nfds_t *nfds, nfds_t *i, struct pollfd **fds, client_conn **conns);
+int fds_realloc(struct pollfd **fds_ptr, client_conn ***conns_ptr, size_t *fds_capacity_ptr);
+long long monotonic_ms(void);
+long long monotonic_us(void);
+int parse_unsigned(const char *str, unsigned long long min, unsigned long long max, unsigned long long *out);
 ssize_t send_all(int sockfd, const unsigned char *buf, size_t len);
 #endif // SERVER_UTILS_H
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "simulate.h"
+#include "conf.h"
+#include "telemetry.h"
+#include "columnar.h"
+
+#define SIM_OUT_BUFFER_SIZE (1024 * 1024)
+#define SIM_RECORD_MAX 64
+#define SIM_PATH_SIZE 512
+
+typedef struct sim_slot {
+    long long next_ms;
+    virtual_source *source;
+} sim_slot;
+
+typedef struct sim_worker {
+    int index;
+    pthread_t thread;
+    virtual_source *sources;
+    size_t count;
+    const sim_options *options;
+    char path[SIM_PATH_SIZE];
+    unsigned long long records;
+    unsigned long long bytes;
+    int result;
+} sim_worker;
+
+static void heap_sift_down(sim_slot *heap, size_t count, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < count && heap[left].next_ms < heap[smallest].next_ms) smallest = left;
+        if (right < count && heap[right].next_ms < heap[smallest].next_ms) smallest = right;
+        if (smallest == i) {
+            return;
+        }
+        sim_slot tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+// Emits the worker's sources in virtual-time order into its own file.
+static void *sim_worker_function(void *arg) {
+    sim_worker *w = (sim_worker *)arg;
+    long long end_ms = w->options->start_ms + w->options->duration_ms;
+
+    w->result = -1;
+    const cpu_list *cpus = w->options->cpus;
+    if (cpus != NULL && cpus->count > 0) {
+        affinity_pin_self_to_cpu(cpus->cpus[w->index % cpus->count]);
+    }
+    sim_slot *heap = malloc((w->count + 1) * sizeof(sim_slot));
+    unsigned char *out = malloc(SIM_OUT_BUFFER_SIZE);
+    int fd = open(w->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (heap == NULL || out == NULL || fd < 0) {
+        perror(fd < 0 ? w->path : "malloc simulation buffers");
+        goto out;
+    }
+
+    size_t heap_count = 0;
+    for (size_t i = 0; i < w->count; ++i) {
+        if (w->sources[i].is_active && w->sources[i].update_interval_ms > 0) {
+            heap[heap_count].next_ms = w->options->start_ms;
+            heap[heap_count].source = &w->sources[i];
+            heap_count++;
+        }
+    }
+    for (size_t i = heap_count / 2; i-- > 0;) {
+        heap_sift_down(heap, heap_count, i);
+    }
+
+    size_t out_len = 0;
+    while (heap_count > 0 && heap[0].next_ms < end_ms) {
+        virtual_source *source = heap[0].source;
+        update_source_reading_at(source, heap[0].next_ms);
+        columnar_append(&source->data);
+
+        if (SIM_OUT_BUFFER_SIZE - out_len < SIM_RECORD_MAX) {
+            if (write_all(fd, out, out_len) < 0) {
+                perror("write simulation output");
+                goto out;
+            }
+            w->bytes += out_len;
+            out_len = 0;
+        }
+        ssize_t n = serialize_telemetry_data(&source->data, out + out_len, SIM_OUT_BUFFER_SIZE - out_len);
+        if (n > 0) {
+            out_len += (size_t)n;
+            w->records++;
+        }
+
+        heap[0].next_ms += source->update_interval_ms;
+        heap_sift_down(heap, heap_count, 0);
+    }
+
+    if (write_all(fd, out, out_len) < 0) {
+        perror("write simulation output");
+        goto out;
+    }
+    w->bytes += out_len;
+    w->result = 0;
+
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(out);
+    free(heap);
+    return NULL;
+}
+
+int simulate_run(const sim_options *options) {
+    srand((unsigned int)options->seed);
+    source_config config = load_sources_config_file(options->config_path);
+    if (config.count == 0) {
+        fprintf(stderr, "No sources configured\n");
+        return -1;
+    }
+
+    // Streams depend only on the seed and the source id, not on the
+    // number of workers a source ends up on.
+    for (size_t i = 0; i < config.count; ++i) {
+        seed_source(&config.sources[i], options->seed ^ ((uint64_t)config.sources[i].id * 0x9E3779B97F4A7C15ULL));
+    }
+
+    size_t threads = options->threads > 0 ? (size_t)options->threads : 1;
+    if (threads > config.count) {
+        printf("Only %zu sources, using %zu threads instead of %zu\n", config.count, config.count, threads);
+        threads = config.count;
+    }
+    sim_worker *workers = calloc(threads, sizeof(sim_worker));
+    if (workers == NULL) {
+        perror("calloc simulation workers");
+        free_sources_config(config);
+        return -1;
+    }
+
+    printf("Simulating %zu sources for %lld ms of virtual time on %zu threads (seed %llu)\n",
+           config.count, options->duration_ms, threads, (unsigned long long)options->seed);
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    size_t per_worker = config.count / threads;
+    size_t extra = config.count % threads;
+    size_t next = 0;
+    size_t started_count = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        sim_worker *w = &workers[i];
+        w->index = (int)i;
+        w->options = options;
+        w->sources = &config.sources[next];
+        w->count = per_worker + (i < extra ? 1 : 0);
+        next += w->count;
+        if (threads == 1) {
+            snprintf(w->path, sizeof(w->path), "%s", options->output_path);
+        } else {
+            snprintf(w->path, sizeof(w->path), "%s.%zu", options->output_path, i);
+        }
+
+        int ret = pthread_create(&w->thread, NULL, sim_worker_function, w);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to create simulation thread: %s\n", strerror(ret));
+            w->result = -1;
+            break;
+        }
+        started_count++;
+    }
+
+    int result = started_count == threads ? 0 : -1;
+    unsigned long long records = 0, bytes = 0;
+    for (size_t i = 0; i < started_count; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].result < 0) {
+            result = -1;
+        }
+        records += workers[i].records;
+        bytes += workers[i].bytes;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double elapsed = (double)(finished.tv_sec - started.tv_sec) +
+                     (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+    printf("Simulation %s: %llu records, %llu bytes in %.3f s (%.0f records/s)\n",
+           result == 0 ? "finished" : "failed", records, bytes, elapsed,
+           elapsed > 0.0 ? (double)records / elapsed : 0.0);
+
+    free(workers);
+    free_sources_config(config);
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stdint.h>
+
+#include "affinity.h"
+
+// Offline generation on a virtual clock: every source is advanced by its
+// update_interval_ms without sleeping, and the records are written as the
+// same 'T' frames the server sends. Sources are split between worker
+// threads; with more than one worker each writes "<output_path>.<n>".
+// A source is never split: its readings form one random walk in time
+// order, so there are at most as many workers as sources and a single
+// high-rate source runs on one thread whatever `threads` says.
+// With columnar export open the same readings also go to the column files,
+// with rows of different workers interleaved within a block; a worker
+// waits for the column writer rather than drop rows, and the run fails if
+// any row was dropped.
+
+#define SIM_DEFAULT_START_MS 1704067200000LL // 2024-01-01T00:00:00Z
+#define SIM_DEFAULT_OUTPUT "telemetry.bin"
+#define SIM_MAX_THREADS 1024
+#define SIM_MAX_SECONDS 1e9                // about 31 years of virtual time
+#define SIM_MAX_START_MS 4102444800000ULL  // 2100-01-01T00:00:00Z
+
+typedef struct sim_options {
+    const char *config_path;
+    const char *output_path;
+    long long start_ms;
+    long long duration_ms;
+    uint64_t seed;
+    int threads;          // capped at the number of sources
+    const cpu_list *cpus; // workers pinned round-robin, NULL or empty - unpinned
+} sim_options;
+
+int simulate_run(const sim_options *options);
+
+#endif // SIMULATE_H
@@ -0,0 +1,154 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "telemetry.h"
+
+#define RECORD_BUFFER_SIZE 64
+
+static unsigned char *snapshot_data = NULL; // under sources_mutex
+static size_t snapshot_len = 0;
+static size_t snapshot_count = 0;
+static unsigned long snapshot_generation = 1; // entries from older layouts don't patch
+
+// Immutable copy handed to joining clients by reference. It is reused
+// until the live buffer changes, so a join storm between two readings
+// costs one copy in total.
+typedef struct frozen_snapshot {
+    atomic_uint refs;
+    size_t len;
+    size_t count;
+    unsigned char data[];
+} frozen_snapshot;
+
+static frozen_snapshot *frozen = NULL; // under sources_mutex
+static bool frozen_stale = true;
+
+static void frozen_release(void *owner) {
+    frozen_snapshot *snap = owner;
+    if (snap != NULL && atomic_fetch_sub(&snap->refs, 1) == 1) {
+        free(snap);
+    }
+}
+
+// Caller holds sources_mutex.
+void snapshot_patch(source_entry *entry) {
+    if (entry->snapshot_generation != snapshot_generation) {
+        return;
+    }
+    serialize_telemetry_data(&entry->source.data, snapshot_data + entry->snapshot_offset,
+                             snapshot_len - entry->snapshot_offset);
+    frozen_stale = true;
+}
+
+// Caller serializes table writers. A NULL table drops the snapshot.
+void snapshot_rebuild(const source_table *table) {
+    unsigned char record[RECORD_BUFFER_SIZE];
+    size_t count = table != NULL ? table->count : 0;
+    unsigned char *data = NULL;
+
+    if (count > 0) {
+        data = malloc(count * RECORD_BUFFER_SIZE);
+        if (data == NULL) {
+            perror("malloc snapshot");
+        }
+    }
+
+    pthread_mutex_lock(&sources_mutex);
+    snapshot_generation++;
+    size_t len = 0, included = 0;
+    for (size_t i = 0; i < count && data != NULL; ++i) {
+        source_entry *entry = table->entries[i];
+        if (!entry->source.is_active) {
+            continue;
+        }
+        ssize_t bytes = serialize_telemetry_data(&entry->source.data, record, sizeof(record));
+        if (bytes <= 0) {
+            continue;
+        }
+        memcpy(data + len, record, (size_t)bytes);
+        entry->snapshot_offset = len;
+        entry->snapshot_generation = snapshot_generation;
+        len += (size_t)bytes;
+        included++;
+    }
+    unsigned char *old = snapshot_data;
+    snapshot_data = data;
+    snapshot_len = len;
+    snapshot_count = included;
+    frozen_snapshot *old_frozen = frozen;
+    frozen = NULL;
+    frozen_stale = true;
+    pthread_mutex_unlock(&sources_mutex);
+
+    free(old);
+    frozen_release(old_frozen);
+}
+
+// Takes a reference to an up-to-date frozen copy. Only a memcpy runs under
+// sources_mutex; the allocation happens outside and is retried if the
+// layout changed meanwhile.
+static frozen_snapshot *freeze(void) {
+    frozen_snapshot *fresh = NULL;
+    for (;;) {
+        pthread_mutex_lock(&sources_mutex);
+        if (frozen != NULL && !frozen_stale) {
+            frozen_snapshot *snap = frozen;
+            atomic_fetch_add(&snap->refs, 1);
+            pthread_mutex_unlock(&sources_mutex);
+            free(fresh);
+            return snap;
+        }
+        size_t len = snapshot_len;
+        if (len == 0 || (fresh != NULL && fresh->len == len)) {
+            break;
+        }
+        pthread_mutex_unlock(&sources_mutex);
+
+        free(fresh);
+        fresh = malloc(sizeof(*fresh) + len);
+        if (fresh == NULL) {
+            perror("malloc frozen snapshot");
+            return NULL;
+        }
+        fresh->len = len;
+    }
+
+    // sources_mutex held here
+    if (snapshot_len == 0) {
+        pthread_mutex_unlock(&sources_mutex);
+        free(fresh);
+        return NULL;
+    }
+    memcpy(fresh->data, snapshot_data, fresh->len);
+    fresh->count = snapshot_count;
+    atomic_init(&fresh->refs, 2); // the cache and the caller
+    frozen_snapshot *old = frozen;
+    frozen = fresh;
+    frozen_stale = false;
+    pthread_mutex_unlock(&sources_mutex);
+
+    frozen_release(old);
+    return fresh;
+}
+
+// Queues the snapshot for a client that has just joined. It goes out by
+// reference, outside the per-client queue limit, however many sources
+// there are.
+int snapshot_send(client_conn *conn) {
+    frozen_snapshot *snap = freeze();
+    if (snap == NULL) {
+        return 0;
+    }
+    size_t len = snap->len;
+    size_t count = snap->count;
+    if (client_queue_ref(conn, snap->data, len, snap, frozen_release) < 0) {
+        return -1;
+    }
+    conn->stats.records_sent += count;
+    conn->stats.bytes_sent += len;
+    conn->stats.bytes_raw += len;
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "client.h"
+#include "registry.h"
+
+// Latest reading of every active source, kept serialized as a run of 'T'
+// records. Each source owns a fixed slot that its generator patches in
+// place after every reading. Joining clients share a frozen, refcounted
+// copy queued by reference, so they get the current state with one write
+// instead of waiting for the next tick.
+//
+// The layout follows the published table and is rebuilt by the table
+// writers; the contents are guarded by sources_mutex.
+
+void snapshot_rebuild(const source_table *table);
+void snapshot_patch(source_entry *entry);
+int snapshot_send(client_conn *conn);
+
+#endif // SNAPSHOT_H
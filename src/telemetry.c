@@ -19,9 +19,23 @@ long long get_current_time_ms() {
     return (long long)(ts.tv_sec) * 1000 + (ts.tv_nsec / 1000000);
 }
 
+// splitmix64: each source owns its stream, so readings are reproducible
+// from a seed and generator threads do not share rand() state.
+void seed_source(virtual_source *source, uint64_t seed) {
+    source->rng_state = seed;
+}
+
+static double source_random(virtual_source *source) {
+    uint64_t z = (source->rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
 float generate_temperature(virtual_source *source) {
 
-    float change = ((float)rand() / RAND_MAX) * 2 * source->max_change - source->max_change;
+    float change = (float)source_random(source) * 2 * source->max_change - source->max_change;
     float new_value = source->current_value + change;
     if (new_value < source->min_value) {
         new_value = source->min_value;
@@ -33,8 +47,8 @@ float generate_temperature(virtual_source *source) {
 }
 
 gps_data generate_gps(virtual_source *source) {
-    double lat_change = ((rand() / (double)RAND_MAX) * 2.0 - 1.0) * source->max_gps_change;
-    double lon_change = ((rand() / (double)RAND_MAX) * 2.0 - 1.0) * source->max_gps_change;
+    double lat_change = (source_random(source) * 2.0 - 1.0) * source->max_gps_change;
+    double lon_change = (source_random(source) * 2.0 - 1.0) * source->max_gps_change;
     gps_data new_gps = source->gps;
     new_gps.latitude += lat_change;
     new_gps.longitude += lon_change;
@@ -50,12 +64,12 @@ const char *generate_status(virtual_source *source) {
     if (source->num_statuses <= 0) {
         return "NO_STATUSES_CONFIGURED"; // Возвращаем строку-ошибку
     }
-    int status_index = rand() % source->num_statuses;
+    int status_index = (int)(source_random(source) * source->num_statuses);
     return source->statuses[status_index];
 }
 
 float generate_humidity(virtual_source *source) {
-    float change = ((float)rand() / RAND_MAX) * 2 * source->max_change - source->max_change;
+    float change = (float)source_random(source) * 2 * source->max_change - source->max_change;
     float new_value = source->current_value + change;
     if (new_value < source->min_value) {
         new_value = source->min_value;
@@ -66,7 +80,7 @@ float generate_humidity(virtual_source *source) {
     return new_value;
 }
 float generate_pressure(virtual_source *source) {
-    float change = ((float)rand() / RAND_MAX) * 2 * source->max_change - source->max_change;
+    float change = (float)source_random(source) * 2 * source->max_change - source->max_change;
     float new_value = source->current_value + change;
     if (new_value < source->min_value) {
         new_value = source->min_value;
@@ -78,12 +92,16 @@ float generate_pressure(virtual_source *source) {
 }
 
 void update_source_reading(virtual_source *source) {
+    update_source_reading_at(source, get_current_time_ms());
+}
+
+void update_source_reading_at(virtual_source *source, long long timestamp_ms) {
     if (!source || !source->is_active) {
        return;
    }
    source->data.id = source->id;
    source->data.type = source->type;
-   source->data.timestamp_ms = get_current_time_ms();
+   source->data.timestamp_ms = timestamp_ms;
 
    switch(source->type) {
        case DATA_TYPE_TEMPERATURE:
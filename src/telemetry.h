@@ -3,6 +3,7 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 
@@ -48,17 +49,20 @@ typedef struct virtual_source {
     double max_gps_change;
     const char *statuses[5];
     int num_statuses;
+    uint64_t rng_state;
     telemetry_data data;
 } virtual_source;
 
 
 long long get_current_time_ms();
+void seed_source(virtual_source *source, uint64_t seed);
 float generate_temperature(virtual_source *source);
 float generate_pressure(virtual_source *source);
 float generate_humidity(virtual_source *source);
 gps_data generate_gps(virtual_source *source);
 const char *generate_status(virtual_source *source);
 void update_source_reading(virtual_source *source);
+void update_source_reading_at(virtual_source *source, long long timestamp_ms);
 
 ssize_t serialize_telemetry_data(const telemetry_data *data, unsigned char *buffer, size_t buffer_size);
 
@@ -0,0 +1,286 @@
+// Round trip of the columnar export: rows go in through columnar_append,
+// come back through the reader API and must match exactly.
+//
+//   columnar_test
+//
+// Covers every encoding (FOR and delta bit packing including full-width
+// deltas, raw f32/f64, the status dictionary and its overflow into a new
+// block), appending to the file of an earlier run, refusing a file that
+// is not ours, and producers outrunning the writer: a lossless export
+// must keep every row, the other one must count every row it drops.
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "columnar.h"
+#include "test_util.h"
+
+#define TEST_DIR_TEMPLATE "/tmp/columnar_test.XXXXXX"
+#define TEST_PRODUCERS 4 // one per scalar type and gps
+#define TEST_PRODUCER_BLOCKS 8 // together twice COLUMNAR_POOL_BLOCKS
+#define TEST_MAX_ROWS (TEST_PRODUCER_BLOCKS * COLUMNAR_BLOCK_ROWS)
+
+typedef struct expected_rows {
+    size_t count;
+    telemetry_data rows[TEST_MAX_ROWS];
+} expected_rows;
+
+static expected_rows expected[COLUMNAR_TYPES];
+
+static void append(const telemetry_data *data) {
+    expected_rows *e = &expected[data->type];
+    if (e->count < TEST_MAX_ROWS) {
+        e->rows[e->count++] = *data;
+    }
+    columnar_append(data);
+}
+
+static void append_run(long long base_ms) {
+    telemetry_data data;
+
+    // A block and a half of each of two scalar types, ids spanning the
+    // whole int range.
+    for (int i = 0; i < 3 * COLUMNAR_BLOCK_ROWS; ++i) {
+        memset(&data, 0, sizeof(data));
+        data.type = i % 2 == 0 ? DATA_TYPE_TEMPERATURE : DATA_TYPE_HUMIDITY;
+        data.id = i % 3 == 0 ? INT_MAX : (int)(next_random() % 1000);
+        data.timestamp_ms = base_ms + i * 100 - (long long)(next_random() % 50);
+        data.value.temperature = (float)((double)(next_random() % 200000) / 1000.0 - 100.0);
+        append(&data);
+    }
+
+    // Timestamps that need every bit of a zigzag delta.
+    long long extremes[] = {0, LLONG_MAX, LLONG_MIN, -1, LLONG_MAX, 0};
+    for (size_t i = 0; i < sizeof(extremes) / sizeof(extremes[0]); ++i) {
+        memset(&data, 0, sizeof(data));
+        data.type = DATA_TYPE_PRESSURE;
+        data.id = (int)i;
+        data.timestamp_ms = extremes[i];
+        data.value.pressure = 1013.25f + (float)i;
+        append(&data);
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        memset(&data, 0, sizeof(data));
+        data.type = DATA_TYPE_GPS;
+        data.id = 7;
+        data.timestamp_ms = base_ms + i;
+        data.value.gps.latitude = 55.75 + (double)(next_random() % 100000) * 1e-9;
+        data.value.gps.longitude = -37.61 - (double)(next_random() % 100000) * 1e-9;
+        append(&data);
+    }
+
+    // More distinct statuses than a block's dictionary holds, names of
+    // every length up to the full 20 bytes.
+    for (int i = 0; i < COLUMNAR_DICT_MAX + 50; ++i) {
+        memset(&data, 0, sizeof(data));
+        data.type = DATA_TYPE_STATUS;
+        data.id = 333;
+        data.timestamp_ms = base_ms + i;
+        snprintf(data.value.status, sizeof(data.value.status), "S%d", i);
+        if (i % 7 == 0) {
+            memset(data.value.status, 'X', sizeof(data.value.status));
+        }
+        append(&data);
+    }
+}
+
+static void compare_row(telemetry_data_type type, const telemetry_data *want, const columnar_block *b,
+                        uint32_t i, size_t row) {
+    CHECK(b->ids[i] == (uint32_t)want->id, "%s row %zu: id %u, want %d",
+          columnar_type_name(type), row, b->ids[i], want->id);
+    CHECK(b->timestamps[i] == want->timestamp_ms, "%s row %zu: timestamp %lld, want %lld",
+          columnar_type_name(type), row, (long long)b->timestamps[i], want->timestamp_ms);
+    switch (type) {
+        case DATA_TYPE_GPS:
+            CHECK(b->latitudes[i] == want->value.gps.latitude && b->longitudes[i] == want->value.gps.longitude,
+                  "gps row %zu: %.9f %.9f, want %.9f %.9f", row, b->latitudes[i], b->longitudes[i],
+                  want->value.gps.latitude, want->value.gps.longitude);
+            break;
+        case DATA_TYPE_STATUS:
+            CHECK(b->status_codes[i] < b->dict_count &&
+                  strncmp(b->dict[b->status_codes[i]], want->value.status, COLUMNAR_STATUS_SIZE) == 0,
+                  "status row %zu: %.20s, want %.20s", row,
+                  b->status_codes[i] < b->dict_count ? b->dict[b->status_codes[i]] : "?", want->value.status);
+            break;
+        default:
+            CHECK(b->values[i] == want->value.temperature, "%s row %zu: %g, want %g",
+                  columnar_type_name(type), row, b->values[i], want->value.temperature);
+            break;
+    }
+}
+
+static void check_file(const char *dir, int type) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.tcol", dir, columnar_type_name((telemetry_data_type)type));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        CHECK(expected[type].count == 0, "%s: missing", path);
+        return;
+    }
+
+    telemetry_data_type file_type;
+    CHECK(columnar_read_file_header(file, &file_type) == 0 && (int)file_type == type, "%s: bad header", path);
+
+    columnar_block *block = malloc(sizeof(*block));
+    unsigned char *scratch = NULL;
+    size_t scratch_cap = 0;
+    columnar_block_header header;
+    columnar_column_desc descs[COLUMNAR_MAX_COLUMNS];
+    size_t row = 0;
+    bool extra = false;
+    while (block != NULL && !extra && columnar_read_block_header(file, &header, descs) > 0) {
+        if (columnar_read_block(file, &header, descs, block, &scratch, &scratch_cap) < 0) {
+            CHECK(0, "%s: block at row %zu does not decode", path, row);
+            break;
+        }
+        for (uint32_t i = 0; i < block->rows; ++i, ++row) {
+            if (row == expected[type].count) {
+                CHECK(0, "%s: extra row %zu, want %zu rows", path, row, expected[type].count);
+                extra = true;
+                break;
+            }
+            compare_row((telemetry_data_type)type, &expected[type].rows[row], block, i, row);
+        }
+    }
+    CHECK(extra || row == expected[type].count, "%s: %zu rows, want %zu", path, row, expected[type].count);
+
+    free(scratch);
+    free(block);
+    fclose(file);
+}
+
+static size_t count_rows(const char *dir, int type) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.tcol", dir, columnar_type_name((telemetry_data_type)type));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    telemetry_data_type file_type;
+    size_t rows = 0;
+    if (columnar_read_file_header(file, &file_type) == 0) {
+        columnar_block_header header;
+        columnar_column_desc descs[COLUMNAR_MAX_COLUMNS];
+        while (columnar_read_block_header(file, &header, descs) > 0 && columnar_skip_block(file, &header) == 0) {
+            rows += header.rows;
+        }
+    }
+    fclose(file);
+    return rows;
+}
+
+static void remove_files(const char *dir) {
+    char path[512];
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        snprintf(path, sizeof(path), "%s/%s.tcol", dir, columnar_type_name((telemetry_data_type)t));
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+// Appends TEST_PRODUCER_BLOCKS full blocks of one type as fast as it can.
+// Each producer owns its type, so expected[] needs no lock.
+static void *producer(void *arg) {
+    telemetry_data_type type = (telemetry_data_type)(intptr_t)arg;
+    telemetry_data data;
+    for (int i = 0; i < TEST_MAX_ROWS; ++i) {
+        memset(&data, 0, sizeof(data));
+        data.type = type;
+        data.id = i % 97;
+        data.timestamp_ms = 1704067200000LL + i;
+        if (type == DATA_TYPE_GPS) {
+            data.value.gps.latitude = (double)i * 1e-6;
+            data.value.gps.longitude = -(double)i * 1e-6;
+        } else {
+            data.value.temperature = (float)(i % 1000) / 10.0f;
+        }
+        append(&data);
+    }
+    return NULL;
+}
+
+static void back_pressure(bool wait_for_writer) {
+    char dir[] = TEST_DIR_TEMPLATE;
+    if (mkdtemp(dir) == NULL) {
+        CHECK(0, "mkdtemp failed");
+        return;
+    }
+    memset(expected, 0, sizeof(expected));
+    if (columnar_open(dir, wait_for_writer) < 0) {
+        CHECK(0, "columnar_open %s failed", dir);
+        rmdir(dir);
+        return;
+    }
+    pthread_t threads[TEST_PRODUCERS];
+    int started = 0;
+    for (int i = 0; i < TEST_PRODUCERS; ++i) {
+        if (pthread_create(&threads[i], NULL, producer, (void *)(intptr_t)i) != 0) {
+            CHECK(0, "pthread_create failed");
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    columnar_close();
+
+    unsigned long long dropped = columnar_rows_dropped();
+    if (wait_for_writer) {
+        CHECK(dropped == 0, "lossless export dropped %llu rows", dropped);
+        for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+            check_file(dir, t);
+        }
+    } else {
+        size_t rows = 0, appended = 0;
+        for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+            rows += count_rows(dir, t);
+            appended += expected[t].count;
+        }
+        CHECK(rows + dropped == appended, "%zu rows written and %llu dropped of %zu", rows, dropped, appended);
+    }
+    remove_files(dir);
+}
+
+int main(void) {
+    char dir[] = TEST_DIR_TEMPLATE;
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    // Two runs: the second appends to the files of the first.
+    for (int run = 0; run < 2; ++run) {
+        if (columnar_open(dir, false) < 0) {
+            fprintf(stderr, "columnar_open %s failed on run %d\n", dir, run);
+            return EXIT_FAILURE;
+        }
+        append_run(1704067200000LL + run * 3600000LL);
+        columnar_close();
+    }
+    for (int t = 0; t < COLUMNAR_TYPES; ++t) {
+        check_file(dir, t);
+    }
+
+    // A file that is not a column file must not be appended to.
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.tcol", dir, columnar_type_name(DATA_TYPE_GPS));
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        fputs("not a column file", file);
+        fclose(file);
+    }
+    CHECK(columnar_open(dir, false) < 0, "columnar_open accepted a foreign %s", path);
+    remove_files(dir);
+
+    back_pressure(true);
+    back_pressure(false);
+
+    return test_result("columnar_test");
+}
@@ -0,0 +1,188 @@
+// Round trip of the shared compression streams: a sequence of ticks is
+// compressed with one compress_stream and inflated the way a peer reads
+// 'Z' records, starting a raw inflate stream on every restart, and must
+// come back byte for byte.
+//
+//   compress_test
+//
+// Also checks the record header, that every record fits compress_bound,
+// that a tick is compressed once for all clients, that later frames get
+// smaller by referring back to earlier ones, that incompressible frames
+// still fit the bound, that a late joiner gets a restart it can start
+// from, and that stream memory is charged to the pool budget.
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "compress.h"
+#include "pool.h"
+#include "test_util.h"
+
+#define TEST_FRAMES 200
+#define TEST_FRAME_MAX 70000
+
+// Looks like a tick: a run of 'T' records of a few sources whose values
+// drift; `noise` frames are random bytes instead.
+static size_t make_frame(unsigned char *frame, int n, int noise) {
+    size_t len = 0;
+    if (noise) {
+        len = TEST_FRAME_MAX - (size_t)(next_random() % 1000);
+        for (size_t i = 0; i < len; ++i) {
+            frame[i] = (unsigned char)next_random();
+        }
+        return len;
+    }
+    for (uint32_t id = 100; id < 110; ++id) {
+        uint32_t net_id = htonl(id);
+        uint32_t reading = htonl(20000u + (uint32_t)(n * 3 + (int)(next_random() % 5)));
+        frame[len++] = 'T';
+        memcpy(frame + len, &net_id, sizeof(net_id));
+        len += sizeof(net_id);
+        frame[len++] = 0;
+        memcpy(frame + len, &reading, sizeof(reading));
+        len += sizeof(reading);
+    }
+    return len;
+}
+
+typedef struct peer {
+    z_stream inflater;
+    bool started;
+} peer;
+
+// Feeds one record to a peer; false when it cannot be decoded.
+static bool peer_read(peer *p, const compress_record *record, unsigned char *out, size_t *out_len) {
+    if (compress_record_restarts(record)) {
+        if (p->started) {
+            inflateEnd(&p->inflater);
+        }
+        memset(&p->inflater, 0, sizeof(p->inflater));
+        if (inflateInit2(&p->inflater, -15) != Z_OK) {
+            return false;
+        }
+        p->started = true;
+    }
+    if (!p->started) {
+        return false;
+    }
+    p->inflater.next_in = (Bytef *)record->data + COMPRESS_HEADER_SIZE;
+    p->inflater.avail_in = (uInt)(record->len - COMPRESS_HEADER_SIZE);
+    p->inflater.next_out = out;
+    p->inflater.avail_out = TEST_FRAME_MAX;
+    int ret = inflate(&p->inflater, Z_SYNC_FLUSH);
+    *out_len = TEST_FRAME_MAX - p->inflater.avail_out;
+    return ret == Z_OK && p->inflater.avail_in == 0;
+}
+
+static void peer_end(peer *p) {
+    if (p->started) {
+        inflateEnd(&p->inflater);
+    }
+}
+
+static void check_header(const compress_record *record, size_t raw_len, int level, int n) {
+    uint32_t net_raw, net_compressed;
+    memcpy(&net_raw, record->data + 2, sizeof(net_raw));
+    memcpy(&net_compressed, record->data + 6, sizeof(net_compressed));
+    CHECK(record->data[0] == 'Z' && (record->data[1] & ~COMPRESS_FLAG_RESTART) == 0 &&
+          ntohl(net_raw) == raw_len && ntohl(net_compressed) == record->len - COMPRESS_HEADER_SIZE,
+          "level %d frame %d: bad record header", level, n);
+    CHECK(record->len <= compress_bound(raw_len), "level %d frame %d: %zu bytes over the bound %zu",
+          level, n, record->len, compress_bound(raw_len));
+}
+
+// One client in step from the first tick; a second one joins at tick
+// `join` and has to start from a restart.
+static int run(int level, int noise_every, int join) {
+    compress_stream *stream = compress_stream_acquire(level);
+    if (stream == NULL) {
+        CHECK(0, "level %d: no stream", level);
+        return -1;
+    }
+    compress_stream *second = compress_stream_acquire(level);
+    CHECK(second == stream, "level %d: two streams for one level", level);
+
+    unsigned char *raw = malloc(TEST_FRAME_MAX);
+    unsigned char *out = malloc(TEST_FRAME_MAX);
+    peer first_peer = {.started = false}, late_peer = {.started = false};
+    bool late_in_step = false;
+    int restarts = 0;
+    size_t first_len = 0, last_len = 0;
+    for (int n = 0; raw != NULL && out != NULL && n < TEST_FRAMES; ++n) {
+        unsigned long tick = (unsigned long)n + 1;
+        int noise = noise_every > 0 && n % noise_every == noise_every - 1;
+        size_t raw_len = make_frame(raw, n, noise);
+
+        compress_stream_note_peer(stream, n > 0);
+        if (n >= join) {
+            compress_stream_note_peer(stream, late_in_step);
+        }
+        compress_record *record = compress_stream_frame(stream, tick, raw, raw_len);
+        if (record == NULL) {
+            CHECK(0, "level %d frame %d: compression failed", level, n);
+            break;
+        }
+        CHECK(compress_stream_frame(stream, tick, raw, raw_len) == record,
+              "level %d frame %d: compressed twice in one tick", level, n);
+        CHECK(n > 0 || compress_record_restarts(record), "level %d: the first frame does not restart", level);
+        check_header(record, raw_len, level, n);
+        if (compress_record_restarts(record)) {
+            restarts++;
+        }
+
+        size_t got = 0;
+        CHECK(peer_read(&first_peer, record, out, &got) && got == raw_len && memcmp(out, raw, raw_len) == 0,
+              "level %d frame %d: %zu bytes differ from %zu", level, n, got, raw_len);
+        if (n >= join && (late_in_step || compress_record_restarts(record))) {
+            CHECK(peer_read(&late_peer, record, out, &got) && got == raw_len && memcmp(out, raw, raw_len) == 0,
+                  "level %d frame %d: the late peer gets %zu bytes for %zu", level, n, got, raw_len);
+            late_in_step = true;
+        }
+        CHECK(n < join + COMPRESS_RESTART_TICKS || late_in_step,
+              "level %d frame %d: no restart for the late peer", level, n);
+
+        if (!noise && n < join) {
+            if (first_len == 0) {
+                first_len = record->len;
+            }
+            last_len = record->len;
+        }
+    }
+    CHECK(last_len < first_len, "level %d: frames do not shrink with history (%zu then %zu)",
+          level, first_len, last_len);
+    CHECK(restarts == (join < TEST_FRAMES ? 2 : 1), "level %d: %d restarts", level, restarts);
+
+    free(raw);
+    free(out);
+    peer_end(&first_peer);
+    peer_end(&late_peer);
+    compress_stream_release(second);
+    compress_stream_release(stream);
+    return 0;
+}
+
+int main(void) {
+    CHECK(compress_stream_acquire(0) == NULL, "level 0 accepted");
+    CHECK(compress_stream_acquire(COMPRESS_MAX_LEVEL + 1) == NULL, "level %d accepted", COMPRESS_MAX_LEVEL + 1);
+
+    for (int level = 1; level <= COMPRESS_MAX_LEVEL; ++level) {
+        run(level, 0, TEST_FRAMES);
+    }
+    run(COMPRESS_DEFAULT_LEVEL, 10, 50);
+    run(1, 3, 20);
+    CHECK(pool_memory_used() == 0, "%zu bytes still charged", pool_memory_used());
+
+    // The stream's zlib state does not fit a tiny budget.
+    pool_set_budget(4096);
+    compress_stream *stream = compress_stream_acquire(COMPRESS_DEFAULT_LEVEL);
+    CHECK(stream == NULL, "a stream fits in 4 KiB");
+    compress_stream_release(stream);
+    CHECK(pool_memory_used() == 0, "%zu bytes still charged", pool_memory_used());
+
+    return test_result("compress_test");
+}
@@ -0,0 +1,38 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+// Shared by the test programs, each a single translation unit: CHECK
+// reports a failed condition and keeps going, main returns test_result().
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond)) {                                          \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);     \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            failures++;                                         \
+        }                                                       \
+    } while (0)
+
+static inline int test_result(const char *name) {
+    printf("%s: %s\n", name, failures == 0 ? "OK" : "FAILED");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// xorshift64: the same sequence on every run, not thread-safe.
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static inline uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+#endif // TEST_UTIL_H
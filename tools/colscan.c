@@ -0,0 +1,291 @@
+// Scanner for the server's columnar export (-X).
+//
+//   colscan [-i id] [-f from_ms] [-t to_ms] [-l min] [-u max] [-s STATUS] [-p] file.tcol...
+//
+// Blocks whose min/max stats cannot match the filter are skipped without
+// reading their payload. The rest are decoded and filtered column by
+// column with branch-free loops the compiler vectorizes. Prints the
+// matching row count and the aggregate of the value column; -p also prints
+// the rows.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "columnar.h"
+
+typedef struct scan_filter {
+    bool by_id;
+    uint32_t id;
+    int64_t from_ms;
+    int64_t to_ms;
+    double min_value; // scalar types only
+    double max_value;
+    const char *status;
+    bool print_rows;
+} scan_filter;
+
+typedef struct scan_result {
+    unsigned long long blocks_read;
+    unsigned long long blocks_skipped;
+    unsigned long long rows_scanned;
+    unsigned long long rows_matched;
+    double sum;
+    double min;
+    double max;
+    unsigned long long status_counts[COLUMNAR_DICT_MAX];
+    char status_names[COLUMNAR_DICT_MAX][COLUMNAR_STATUS_SIZE + 1];
+    size_t status_kinds;
+} scan_result;
+
+static bool block_may_match(const scan_filter *filter, const columnar_block_header *header,
+                            const columnar_column_desc *descs) {
+    for (uint32_t c = 0; c < header->columns; ++c) {
+        const columnar_column_desc *d = &descs[c];
+        switch (d->column) {
+            case COL_ID:
+                if (filter->by_id && (filter->id < d->min || filter->id > d->max)) return false;
+                break;
+            case COL_TIMESTAMP:
+                if (d->max < (double)filter->from_ms || d->min > (double)filter->to_ms) return false;
+                break;
+            case COL_VALUE:
+                if (d->max < filter->min_value || d->min > filter->max_value) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static void count_status(scan_result *result, const char *status, unsigned long long count) {
+    char name[COLUMNAR_STATUS_SIZE + 1];
+    memcpy(name, status, COLUMNAR_STATUS_SIZE);
+    name[COLUMNAR_STATUS_SIZE] = '\0';
+    for (size_t i = 0; i < result->status_kinds; ++i) {
+        if (strcmp(result->status_names[i], name) == 0) {
+            result->status_counts[i] += count;
+            return;
+        }
+    }
+    if (result->status_kinds < COLUMNAR_DICT_MAX) {
+        strcpy(result->status_names[result->status_kinds], name);
+        result->status_counts[result->status_kinds++] = count;
+    }
+}
+
+static void scan_block(const scan_filter *filter, const columnar_block *b, telemetry_data_type type,
+                       uint8_t *sel, scan_result *result) {
+    uint32_t rows = b->rows;
+
+    for (uint32_t i = 0; i < rows; ++i) {
+        sel[i] = (uint8_t)((b->timestamps[i] >= filter->from_ms) & (b->timestamps[i] <= filter->to_ms));
+    }
+    if (filter->by_id) {
+        for (uint32_t i = 0; i < rows; ++i) {
+            sel[i] &= (uint8_t)(b->ids[i] == filter->id);
+        }
+    }
+
+    unsigned long long matched = 0;
+    if (type == DATA_TYPE_STATUS) {
+        if (filter->status != NULL) {
+            int wanted = -1;
+            for (uint32_t k = 0; k < b->dict_count; ++k) {
+                if (strncmp(b->dict[k], filter->status, COLUMNAR_STATUS_SIZE) == 0) {
+                    wanted = (int)k;
+                }
+            }
+            for (uint32_t i = 0; i < rows; ++i) {
+                sel[i] &= (uint8_t)(b->status_codes[i] == wanted);
+            }
+        }
+        unsigned long long per_code[COLUMNAR_DICT_MAX] = {0};
+        for (uint32_t i = 0; i < rows; ++i) {
+            per_code[b->status_codes[i]] += sel[i];
+        }
+        for (uint32_t k = 0; k < b->dict_count; ++k) {
+            if (per_code[k] > 0) {
+                count_status(result, b->dict[k], per_code[k]);
+            }
+            matched += per_code[k];
+        }
+    } else if (type == DATA_TYPE_GPS) {
+        double sum = 0.0;
+        for (uint32_t i = 0; i < rows; ++i) {
+            matched += sel[i];
+            sum += sel[i] ? b->latitudes[i] : 0.0;
+        }
+        result->sum += sum;
+    } else {
+        float lo = (float)filter->min_value, hi = (float)filter->max_value;
+        for (uint32_t i = 0; i < rows; ++i) {
+            sel[i] &= (uint8_t)((b->values[i] >= lo) & (b->values[i] <= hi));
+        }
+        double sum = 0.0;
+        float min = INFINITY, max = -INFINITY;
+        for (uint32_t i = 0; i < rows; ++i) {
+            float v = b->values[i];
+            matched += sel[i];
+            sum += sel[i] ? v : 0.0f;
+            min = sel[i] && v < min ? v : min;
+            max = sel[i] && v > max ? v : max;
+        }
+        result->sum += sum;
+        if (min < result->min) result->min = min;
+        if (max > result->max) result->max = max;
+    }
+
+    result->rows_scanned += rows;
+    result->rows_matched += matched;
+
+    if (filter->print_rows && matched > 0) {
+        for (uint32_t i = 0; i < rows; ++i) {
+            if (!sel[i]) continue;
+            if (type == DATA_TYPE_GPS) {
+                printf("%u %lld %.6f %.6f\n", b->ids[i], (long long)b->timestamps[i],
+                       b->latitudes[i], b->longitudes[i]);
+            } else if (type == DATA_TYPE_STATUS) {
+                printf("%u %lld %.*s\n", b->ids[i], (long long)b->timestamps[i],
+                       COLUMNAR_STATUS_SIZE, b->dict[b->status_codes[i]]);
+            } else {
+                printf("%u %lld %g\n", b->ids[i], (long long)b->timestamps[i], b->values[i]);
+            }
+        }
+    }
+}
+
+static int scan_file(const char *path, const scan_filter *filter, columnar_block *block, uint8_t *sel) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    telemetry_data_type type;
+    if (columnar_read_file_header(file, &type) < 0) {
+        fprintf(stderr, "%s: not a column file of this version and byte order\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    scan_result *result = calloc(1, sizeof(*result));
+    if (result == NULL) {
+        perror("calloc");
+        fclose(file);
+        return -1;
+    }
+    result->min = INFINITY;
+    result->max = -INFINITY;
+
+    unsigned char *scratch = NULL;
+    size_t scratch_cap = 0;
+    columnar_block_header header;
+    columnar_column_desc descs[COLUMNAR_MAX_COLUMNS];
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    int ret, status = 0;
+    while ((ret = columnar_read_block_header(file, &header, descs)) > 0) {
+        if (!block_may_match(filter, &header, descs)) {
+            result->blocks_skipped++;
+            if (columnar_skip_block(file, &header) < 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        if (columnar_read_block(file, &header, descs, block, &scratch, &scratch_cap) < 0) {
+            ret = -1;
+            break;
+        }
+        result->blocks_read++;
+        scan_block(filter, block, type, sel, result);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "%s: damaged block after %llu blocks\n", path,
+                result->blocks_read + result->blocks_skipped);
+        status = -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double elapsed = (double)(finished.tv_sec - started.tv_sec) +
+                     (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+    long size = ftell(file);
+
+    printf("%s: %s, blocks %llu read %llu skipped, rows %llu scanned %llu matched",
+           path, columnar_type_name(type), result->blocks_read, result->blocks_skipped,
+           result->rows_scanned, result->rows_matched);
+    if (result->rows_matched > 0) {
+        if (type == DATA_TYPE_STATUS) {
+            for (size_t i = 0; i < result->status_kinds; ++i) {
+                printf(", %s=%llu", result->status_names[i], result->status_counts[i]);
+            }
+        } else if (type == DATA_TYPE_GPS) {
+            printf(", mean latitude %.6f", result->sum / (double)result->rows_matched);
+        } else {
+            printf(", min %g max %g mean %g", result->min, result->max,
+                   result->sum / (double)result->rows_matched);
+        }
+    }
+    printf(", %.1f MB/s\n", elapsed > 0.0 ? (double)size / elapsed / 1e6 : 0.0);
+
+    free(scratch);
+    free(result);
+    fclose(file);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    scan_filter filter = {
+        .from_ms = INT64_MIN,
+        .to_ms = INT64_MAX,
+        .min_value = -INFINITY,
+        .max_value = INFINITY,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:f:t:l:u:s:p")) != -1) {
+        switch (opt) {
+            case 'i': filter.by_id = true; filter.id = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'f': filter.from_ms = strtoll(optarg, NULL, 10); break;
+            case 't': filter.to_ms = strtoll(optarg, NULL, 10); break;
+            case 'l': filter.min_value = strtod(optarg, NULL); break;
+            case 'u': filter.max_value = strtod(optarg, NULL); break;
+            case 's': filter.status = optarg; break;
+            case 'p': filter.print_rows = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-i id] [-f from_ms] [-t to_ms] [-l min] [-u max] [-s STATUS] [-p]"
+                                " file.tcol...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "No files to scan\n");
+        return EXIT_FAILURE;
+    }
+
+    columnar_block *block = malloc(sizeof(*block));
+    uint8_t *sel = malloc(COLUMNAR_BLOCK_ROWS);
+    if (block == NULL || sel == NULL) {
+        perror("malloc");
+        free(block);
+        free(sel);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; ++i) {
+        if (scan_file(argv[i], &filter, block, sel) < 0) {
+            status = EXIT_FAILURE;
+        }
+    }
+    free(block);
+    free(sel);
+    return status;
+}